@@ -1,22 +1,63 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime and strtok_r for batch mode
+
 #include <raylib.h>
 #include <raymath.h>
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
 #include <math.h>
 #include <string.h>
 
+#ifndef __EMSCRIPTEN__
+#include <pthread.h>
+#include <time.h>
+#endif
+
 #define MAX_VERTICES 32
 #define MAX_PARTICLES 1000
-#define MAX_PACKABLE_SHAPES 20000 // should be very generous
 
 #define SCREEN_WIDTH 1300
 #define SCREEN_HEIGHT 800
 #define UI_PANEL_WIDTH 340
+#define TARGET_FPS 60
+
+#define PACK_FRAME_HEADROOM (0.1 / TARGET_FPS) // seconds of each frame left over for the buffer swap and timer jitter
+#define PACK_MIN_FRAME_BUDGET (0.1 / TARGET_FPS) // packing still moves along when drawing alone fills the frame
+#define PACK_BUDGET_CHECKS 8 // roughly how many times per frame the clock is read while packing
+#define PACK_MAX_CHUNK 100000.0
+#define PACK_INITIAL_CANDIDATE_TIME 0.0001 // pessimistic guess so the first chunk is small
+#define PACK_RATE_SMOOTHING 0.2f
+#define PACK_RATE_WINDOW 0.5 // seconds of wall time the candidates/s readout is measured over
+
+#define MAX_CONTACT_EVENTS 4096
+#define ANALYTIC_ANGLE_MARGIN (0.05f * DEG2RAD) // how far past a contact angle the analytic mode places a shape
+#define ANALYTIC_COINCIDE_ANGLE (0.005f * DEG2RAD) // crossings closer than this are too close to order reliably
+
+#define COMPACT_STEP_MAX 8.f
+#define COMPACT_STEP_MIN 0.25f
+
+#define CORE_MAX_VERTICES 6
+
+#define SYMMETRY_TOLERANCE 0.01f // max vertex drift, as a fraction of the shape radius, for a rotation to count as symmetric
+#define SWEEP_ANGLE_EPSILON 0.001f // fraction of rotationStep, sampled angles closer than this are the same orientation
+
+#define ZOOM_MIN 0.02f
+#define ZOOM_MAX 8.f
+#define LOD_FILL_ONLY_PIXELS 10.f // shapes smaller than this on screen are drawn without outlines or pop-in
+#define LOD_TILE_PIXELS 3.f // shapes smaller than this are aggregated into shaded grid tiles
+#define LOD_TILE_MIN_PIXELS 8.f
 
 #define GRID_CELL_SIZE 40
-#define GRID_COLS (SCREEN_WIDTH / GRID_CELL_SIZE + 1)
-#define GRID_ROWS (SCREEN_HEIGHT / GRID_CELL_SIZE + 1)
+
+#define BATCH_DEFAULT_THREADS 4
+#define BATCH_MAX_THREADS 64
+#define BATCH_MAX_LINE 4096
+#define BATCH_PROXY_TOLERANCE 2.f
+#define BATCH_MIN_AREA_FRACTION 1e-4f // of the bounding box, polygons flatter than this are rejected
+
+#define OCC_CELL_SIZE 2.f // smallest occupancy cell, doubled until the raster fits in OCC_MAX_CELLS
+#define OCC_MAX_CELLS (4 * 1024 * 1024)
 
 #define CLAMP(x, a, b) ((x) < (a) ? (a) : (x) > (b) ? (b) : (x))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -29,6 +70,18 @@ typedef enum state {
     STATE_DONE
 } State;
 
+typedef enum angleMode {
+    ANGLE_MODE_SAMPLED, // try every rotationStep degrees
+    ANGLE_MODE_ANALYTIC // solve for the angles where the shape touches something and test between them
+} AngleMode;
+
+typedef enum corner {
+    CORNER_TOP_LEFT,
+    CORNER_TOP_RIGHT,
+    CORNER_BOTTOM_LEFT,
+    CORNER_BOTTOM_RIGHT
+} Corner;
+
 typedef struct poly {
     Vector2 vertices[MAX_VERTICES];
     int vertexCount;
@@ -37,6 +90,9 @@ typedef struct poly {
 
 typedef struct packedShape {
     Polygon poly;
+    Polygon proxy; // conservative simplified outline, vertexCount 0 if the exact poly is already as cheap
+    Polygon core; // a few of the poly's hull vertices, so it lies inside it. vertexCount 0 if not cheaper
+    Rectangle bounds;
     float animTimer; // from 0 to 1
     Color color;
 } PackedShape;
@@ -50,84 +106,262 @@ typedef struct particle {
 typedef struct gridCell {
     int* shapeInds;
     int count, cap;
+    int cornerCount; // shapes whose bounds start in this cell, so each is counted once when shading tiles
+    int compactCount; // count before the last compaction
+    char isOpened; // compaction left fewer shapes touching this cell
 } GridCell;
 
+typedef struct occupancyRow {
+    int* freeSpans; // [start, end) column pairs of cells not fully covered by a packed shape
+    int count, cap; // in spans
+} OccupancyRow;
+
+typedef struct contactEvent {
+    float angle; // radians into the sweep
+    int delta; // change in how many vertices sit where they shouldn't, see count_contact_violations
+} ContactEvent;
+
+typedef struct refillRegion {
+    Rectangle bounds; // cells of one connected patch that compaction opened up
+    int freeCells; // of those, how many no shape touches anymore
+    int cellCount;
+} RefillRegion;
+
+typedef struct compactEntry {
+    int shapeInd;
+    float key; // lowest goes first
+} CompactEntry;
+
+// all the state of one packing run, so batch mode can run one per thread
+typedef struct packer {
+    char isBegun; // packer_begin ran since the last packer_release
+    Polygon container;
+    Polygon inner; // centered, the origin is the rotation pivot
+    Polygon innerProxy;
+    Polygon innerCore;
+    Rectangle containerBounds;
+    Vector2 cursor;
+    float posStep, rotationStep;
+    AngleMode angleMode;
+    int symmetryOrder; // inner looks the same every 360/symmetryOrder degrees
+    float* sweepAngles; // degrees, the distinct orientations of the sampled sweep in the order they are tried
+    int sweepCount, sweepCap;
+    float sweepStep; // rotationStep sweepAngles was built for
+    int sweepInd; // progress through the sweep at the cursor, 0 until the position is started, see packer_step
+    AngleMode sweepMode; // angleMode the position was started in
+    char isRefilling; // packing again after compaction, one refill region at a time
+    RefillRegion* refillRegions; // largest free area first
+    int refillCount, refillCap;
+    int refillInd; // region the cursor is in while isRefilling
+
+    PackedShape* shapes;
+    int count, cap;
+
+    GridCell* grid; // gridRows * gridCols cells covering the container bounds
+    int gridCols, gridRows;
+    Vector2 gridOrigin;
+    unsigned int* checkedStamps; // per shape, the last grid query that already visited it
+    int checkedCap;
+    unsigned int checkStamp;
+
+    char occupancyEnabled;
+    char* occupancy; // occRows * occCols
+    OccupancyRow* occupancyRows;
+    int occCols, occRows;
+    float occCellSize;
+    Vector2 occOrigin;
+
+    CompactEntry* compactOrder;
+    long long candidateCount; // candidate placements tested so far
+    ContactEvent events[MAX_CONTACT_EVENTS]; // sorted crossings at the cursor, for find_analytic_angle
+    int eventCount;
+    int* nearbyInds; // packed shapes the candidate can reach from the cursor, for find_analytic_angle
+    int nearbyCount, nearbyCap;
+    int violations; // at the interval find_analytic_angle is in
+    char isViolationStale;
+} Packer;
+
+typedef enum packStep {
+    PACK_STEP_EMPTY, // nothing fit at the cursor
+    PACK_STEP_PLACED, // shapes[count - 1] was just added
+    PACK_STEP_PAUSED, // the candidate limit ran out partway through the cursor position, the next call carries on
+    PACK_STEP_FINISHED // the cursor ran past the bottom of the container
+} PackStep;
+
+typedef enum sweepResult {
+    SWEEP_NONE, // no angle fits at the cursor
+    SWEEP_FOUND,
+    SWEEP_PAUSED
+} SweepResult;
+
+#ifndef __EMSCRIPTEN__
+typedef struct batchJob {
+    char name[64];
+    Polygon container;
+    Polygon inner; // centered like the interactive mode does
+    float posStep, rotationStep;
+    AngleMode angleMode;
+    char isCompacting; // compact towards the top left and refill once packing finishes
+} BatchJob;
+
+typedef struct batchQueue {
+    BatchJob* jobs;
+    int count;
+    int next; // first job no worker has taken yet
+    const char* outDir;
+    pthread_mutex_t lock; // guards next and stdout
+} BatchQueue;
+#endif
+
+
+static void packer_begin(Packer* p, const Polygon* container, const Polygon* inner, float proxyTolerance);
+static PackStep packer_step(Packer* p, long long candidateLimit);
+static void packer_release(Packer* p);
+static void build_sweep_angles(Packer* p);
+
+#ifndef __EMSCRIPTEN__
+static int run_batch(const char* jobsPath, int threadCount, const char* outDir);
+static char parse_batch_job(char* line, BatchJob* job);
+static char parse_poly(char* text, Polygon* poly);
+static void* batch_worker(void* arg);
+static void run_batch_job(Packer* p, const BatchJob* job, BatchQueue* queue);
+#endif
 
 static void handle_drawing(Polygon *poly, State *currentState, State nextState, Sound addSound, Sound finishSound, float* containerArea);
 static int do_lines_intersect(Vector2 A, Vector2 B, Vector2 C, Vector2 D);
 static char is_shape_inside_container(const Polygon* shape, const Polygon* container);
-static char does_shape_overlap_packed(const Polygon* shape, const PackedShape* packedShapes, int packedCount);
+static char does_shape_overlap_packed(Packer* p, const PackedShape* candidate);
 static char check_poly_collisions(const Polygon* p1, const Polygon* p2);
 static void project_poly(Vector2 axis, const Vector2* vertices, int vertexCount, float* min, float* max);
 
+static void place_candidate(const Packer* p, float angle, Vector2 pos, PackedShape* candidate);
+static char is_candidate_valid(Packer* p, const PackedShape* candidate);
+static char is_candidate_inside(const Packer* p, const PackedShape* candidate);
+static SweepResult find_analytic_angle(Packer* p, Vector2 pos, float sweepLimit, long long candidateLimit, PackedShape* candidate);
+static int add_contact_events(const Polygon* inner, Vector2 pos, float radius, const Polygon* obstacle, char isContainer, float sweepLimit, ContactEvent* events, int count);
+static int count_contact_violations(const Polygon* shape, const Polygon* obstacle, char isContainer);
+static int circle_segment_hits(Vector2 center, float r, Vector2 a, Vector2 b, Vector2 hits[2]);
+static int compare_contact_events(const void* a, const void* b);
+
 static Rectangle get_poly_bounds(const Polygon* poly);
 static Vector2 get_poly_center(const Polygon* poly);
 static void draw_poly_lines(const Vector2* vertices, int vertexCount, Color color, float thick);
 static float poly_area(const Polygon* poly);
+static float poly_radius(const Polygon* poly);
 static void ensure_winding(Polygon* poly);
+static char is_poly_convex(const Polygon* poly);
+static char poly_scanline_span(const Polygon* poly, float y, float* minX, float* maxX);
+static int poly_rotational_symmetry(const Polygon* poly, float tolerance);
+static int poly_convex_hull(const Polygon* poly, Vector2 hull[MAX_VERTICES * 2]);
+static void build_collision_proxy(const Polygon* poly, Polygon* proxy, float tolerance);
+static void build_collision_core(const Polygon* poly, Polygon* core, int maxVertices);
 
 static float gui_slider(Rectangle bounds, const char *text, float value, float minValue, float maxValue);
-static void draw_ui_panel(State currentState, int packedCount, float* posStep, float* rotationStep, float efficiency);
+static void draw_ui_panel(State currentState, int packedCount, float* posStep, float* rotationStep, float* proxyTolerance, AngleMode angleMode, Corner compactCorner, float efficiency, float candidatesPerSecond, int positionsPerFrame);
 static void draw_poly_with_handles(Polygon* poly, Color lineColor, Color handleColor);
 static void draw_bg_effect(void);
+static void draw_packed_shapes(const Packer* p);
+static void handle_camera(void);
+static Rectangle get_view_bounds(void);
 
 static void particles_spawn(Particle particles[MAX_PARTICLES], Vector2 center, int n, float ld, float sd);
 static void particles_update_draw(Particle particles[MAX_PARTICLES]);
 
-static void grid_init(void);
-static void grid_clear(void);
-static void grid_add_shape(int shapeInd, const Polygon* poly);
+static void grid_init(Packer* p, Rectangle bounds);
+static void grid_clear(Packer* p);
+static void grid_cell_range(const Packer* p, Rectangle bounds, int* minX, int* minY, int* maxX, int* maxY);
+static unsigned int grid_next_stamp(Packer* p);
+static void grid_add_shape(Packer* p, int shapeInd, const Polygon* poly);
+static void grid_remove_shape(Packer* p, int shapeInd, Rectangle bounds);
+static float grid_next_opened_x(const Packer* p, Vector2 pos);
+static void grid_find_opened_regions(Packer* p);
+static int compare_refill_regions(const void* a, const void* b);
+static Vector2 packer_lattice_start(const Packer* p, Rectangle area);
+
+static int compact_layout(Packer* p, Corner corner);
+static char try_translate_shape(Packer* p, PackedShape* shape, Vector2 delta);
+static int compare_compact_order(const void* a, const void* b);
+
+static void occupancy_init(Packer* p, Rectangle bounds);
+static void occupancy_clear(Packer* p);
+static void occupancy_reset(Packer* p);
+static void occupancy_add_shape(Packer* p, const Polygon* poly);
+static void occupancy_rebuild_row(Packer* p, int row);
+static float occupancy_next_free_x(const Packer* p, Vector2 pos);
 
 static int draggedVert = -1;
 static Polygon* draggedPoly = NULL;
 static Camera2D camera = {0};
+static const Vector2 viewCenter = { (SCREEN_WIDTH - UI_PANEL_WIDTH) / 2.f, SCREEN_HEIGHT / 2.f };
 static float screenShakeIntensity = 0.f;
-static GridCell spatialGrid[GRID_ROWS][GRID_COLS];
-static char checkedInds[MAX_PACKABLE_SHAPES];
 
 
-int main(void) {
+int main(int argc, char** argv) {
+#ifndef __EMSCRIPTEN__
+    // packer --batch jobs.txt [threads] [outDir]
+    if (argc >= 3 && 0 == strcmp(argv[1], "--batch")) {
+        const int threadCount = (argc >= 4) ? atoi(argv[3]) : BATCH_DEFAULT_THREADS;
+        return run_batch(argv[2], CLAMP(threadCount, 1, BATCH_MAX_THREADS), (argc >= 5) ? argv[4] : ".");
+    }
+#else
+    (void)argc;
+    (void)argv;
+#endif
+
     SetConfigFlags(FLAG_WINDOW_RESIZABLE);
     InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Window");
     InitAudioDevice();
-    SetTargetFPS(60);
+    SetTargetFPS(TARGET_FPS);
     
     camera.zoom = 1.f;
-    camera.target = (Vector2){ (SCREEN_WIDTH - UI_PANEL_WIDTH) / 2.f, SCREEN_HEIGHT / 2.f };
-    camera.offset = camera.target;
+    camera.target = viewCenter;
+    camera.offset = viewCenter;
 
     const Sound addSound = LoadSound("assets/menuMove.wav");
     const Sound finishSound = LoadSound("assets/levelComplete.wav");
     const Sound packSound = LoadSound("assets/fs1.wav");
 
-    grid_init();
-
     State currentState = STATE_DRAW_CONTAINER;
     Polygon containerPoly = { .vertexCount = 0, .isClosed = 0 };
     Polygon innerPoly = { .vertexCount = 0, .isClosed = 0 };
 
-    PackedShape* packedShapes = NULL;
-    int packedShapesCount = 0, packedShapesCap = 0;
-
-    Rectangle containerBounds = {0};
-    Vector2 packingCursor = {0};
+    Packer packer = {0};
     
     float posStep = 3.f;
     float rotationStep = 5.f;
+    float proxyTolerance = 2.f;
+    AngleMode angleMode = ANGLE_MODE_SAMPLED;
+    Corner compactCorner = CORNER_TOP_LEFT;
     
     float containerArea = 0.f;
     float packedTotalArea = 0.f;
     float packingEfficiency = 0.f;
+
+    double secondsPerCandidate = PACK_INITIAL_CANDIDATE_TIME; // smoothed worst cost per frame, packer_step calls count as candidates too
+    double drawSeconds = 0.0; // smoothed time from the end of packing to EndDrawing
+    float candidatesPerSecond = 0.f;
+    int positionsPerFrame = 0;
+    double lastPackTime = 0.0; // end of the last packing frame
+    double rateWindowTime = 0.0;
+    long long rateWindowCandidates = 0;
+
+    int animStart = 0; // shapes before this one have finished popping in
     
     Particle particles[MAX_PARTICLES] = {0};
 
     while (!WindowShouldClose()) {
         if (screenShakeIntensity > 0) {
-            camera.offset.x = camera.target.x + ((float)GetRandomValue(-100, 100) / 100.f) * screenShakeIntensity;
-            camera.offset.y = camera.target.y + ((float)GetRandomValue(-100, 100) / 100.f) * screenShakeIntensity;
+            camera.offset.x = viewCenter.x + ((float)GetRandomValue(-100, 100) / 100.f) * screenShakeIntensity;
+            camera.offset.y = viewCenter.y + ((float)GetRandomValue(-100, 100) / 100.f) * screenShakeIntensity;
             screenShakeIntensity *= 0.9f;
         } else {
-            camera.offset = camera.target;
+            camera.offset = viewCenter;
+        }
+
+        handle_camera();
+
+        if (IsKeyPressed(KEY_M)) {
+            angleMode = (ANGLE_MODE_SAMPLED == angleMode) ? ANGLE_MODE_ANALYTIC : ANGLE_MODE_SAMPLED;
         }
 
         switch (currentState) {
@@ -140,107 +374,131 @@ int main(void) {
             } break;
 
             case STATE_PACKING: {
-                if (0 == containerBounds.width) {
-                    containerBounds = get_poly_bounds(&containerPoly);
-                    packingCursor = (Vector2){ containerBounds.x, containerBounds.y };
+                if (!packer.isBegun) {
+                    packer_begin(&packer, &containerPoly, &innerPoly, proxyTolerance);
+                    secondsPerCandidate = PACK_INITIAL_CANDIDATE_TIME;
+                    candidatesPerSecond = 0.f;
+                    rateWindowTime = 0.0;
+                    rateWindowCandidates = 0;
                 }
-
-                const int attemptsPerFrame = 200;
-                for (int c = 0; c < attemptsPerFrame; c += 1) {
-                    if (packingCursor.y >= containerBounds.y + containerBounds.height) {
-                        currentState = STATE_DONE;
-                        
-                        const float innerArea = fabsf(poly_area(&innerPoly));
-                        packedTotalArea = packedShapesCount * innerArea;
-                        if (containerArea > 0) {
-                            packingEfficiency = (packedTotalArea / containerArea) * 100.f;
-                        }
+                packer.posStep = posStep;
+                packer.rotationStep = rotationStep;
+                packer.angleMode = angleMode;
+
+                // packing gets what drawing leaves of the frame. it runs in chunks of candidates sized from the
+                // measured cost per candidate, so the clock is only read a few times per frame, and a chunk can
+                // end partway through a position, which packer_step picks up again in the next one
+                const double packBudget = CLAMP(1.0 / TARGET_FPS - drawSeconds - PACK_FRAME_HEADROOM, PACK_MIN_FRAME_BUDGET, 1.0 / TARGET_FPS);
+                const double packStart = GetTime();
+                const long long candidatesBefore = packer.candidateCount;
+                double worstSecondsPerCandidate = secondsPerCandidate;
+                int chunkSize = (int)CLAMP(packBudget / PACK_BUDGET_CHECKS / worstSecondsPerCandidate, 1.0, PACK_MAX_CHUNK);
+                int stepCount = 0;
+                int positionCount = 0;
+                long long workCount = 0;
+                double elapsed = 0.0;
+                char isOverBudget = 0;
+                while (STATE_PACKING == currentState && !isOverBudget) {
+                    const double chunkStart = elapsed;
+                    const long long chunkWorkStart = workCount;
+                    const long long chunkEnd = packer.candidateCount + chunkSize;
+                    for (int c = 0; c < chunkSize && STATE_PACKING == currentState && packer.candidateCount < chunkEnd; c += 1) {
+                        const Vector2 cursor = packer.cursor;
+                        const PackStep step = packer_step(&packer, chunkEnd);
+                        stepCount += 1;
+                        positionCount += (PACK_STEP_PAUSED != step) ? 1 : 0;
+
+                        if (PACK_STEP_FINISHED == step) {
+                            currentState = STATE_DONE;
                         
-                        screenShakeIntensity = 8.f;
-                        particles_spawn(particles, get_poly_center(&containerPoly), 150, 40.f, 0.4f);
-                        PlaySound(finishSound);
-                        break;
-                    }
-
-                    for (float angle = 0.f; angle < 360.f; angle += rotationStep) {
-                        Polygon candidateShape = { .vertexCount = innerPoly.vertexCount };
+                            const float innerArea = fabsf(poly_area(&innerPoly));
+                            packedTotalArea = packer.count * innerArea;
+                            if (containerArea > 0) {
+                                packingEfficiency = (packedTotalArea / containerArea) * 100.f;
+                            }
                         
-                        for (int i = 0; i < innerPoly.vertexCount; i += 1) {
-                            const Vector2 rotated = Vector2Rotate(innerPoly.vertices[i], angle * DEG2RAD);
-                            candidateShape.vertices[i] = Vector2Add(rotated, packingCursor);
+                            screenShakeIntensity = 8.f;
+                            particles_spawn(particles, get_poly_center(&containerPoly), 150, 40.f, 0.4f);
+                            PlaySound(finishSound);
                         }
 
-                        if (is_shape_inside_container(&candidateShape, &containerPoly) &&
-                            !does_shape_overlap_packed(&candidateShape, packedShapes, packedShapesCount)
-                        ) {
-                            if (packedShapesCount >= packedShapesCap) {
-                                packedShapesCap = (0 == packedShapesCap) ? 16 : packedShapesCap * 2;
-                                packedShapes = realloc(packedShapes, packedShapesCap * sizeof(PackedShape));
-                            }
+                        if (PACK_STEP_PLACED == step) {
+                            SetRandomSeed((packer.count - 1) * 31415);
+                            packer.shapes[packer.count - 1].color = (Color){ GetRandomValue(40, 120), GetRandomValue(10, 50), GetRandomValue(150, 240), 150 };
 
-                            if (packedShapes) {
-                                SetRandomSeed(packedShapesCount * 31415);
-                                packedShapes[packedShapesCount] = (PackedShape){
-                                    .poly = candidateShape,
-                                    .animTimer = 0.f,
-                                    .color = { GetRandomValue(40, 120), GetRandomValue(10, 50), GetRandomValue(150, 240), 150 }
-                                };
-                                grid_add_shape(packedShapesCount, &candidateShape);
-                                packedShapesCount += 1;
-
-                                SetSoundPitch(packSound, (float)GetRandomValue(95, 105)/100.f);
-                                PlaySound(packSound);
-                                
-                                particles_spawn(particles, packingCursor, 12, 200.f, 3.f);
-                                screenShakeIntensity = 1.f;
-                            }
-                            
-                            break;
+                            SetSoundPitch(packSound, (float)GetRandomValue(95, 105)/100.f);
+                            PlaySound(packSound);
+                        
+                            particles_spawn(particles, cursor, 12, 200.f, 3.f);
+                            screenShakeIntensity = 1.f;
                         }
                     }
-                    
-                    packingCursor.x += posStep;
-                    if (packingCursor.x >= containerBounds.x + containerBounds.width) {
-                        packingCursor.x = containerBounds.x;
-                        packingCursor.y += posStep;
+
+                    // candidates cost ten times more in crowded spots than in open ones, so chunks are sized from the
+                    // most expensive one seen this frame, then packing stops once the next is predicted to run past the budget
+                    elapsed = GetTime() - packStart;
+                    workCount = packer.candidateCount - candidatesBefore + stepCount;
+                    worstSecondsPerCandidate = MAX(worstSecondsPerCandidate, (elapsed - chunkStart) / MAX(1, workCount - chunkWorkStart));
+                    chunkSize = (int)CLAMP(packBudget / PACK_BUDGET_CHECKS / worstSecondsPerCandidate, 1.0, PACK_MAX_CHUNK);
+                    isOverBudget = elapsed + chunkSize * worstSecondsPerCandidate > packBudget;
+                }
+
+                // the worst rate rather than the average, so the first chunk of the next frame stays in budget too
+                secondsPerCandidate += (worstSecondsPerCandidate - secondsPerCandidate) * PACK_RATE_SMOOTHING;
+                positionsPerFrame = positionCount;
+
+                // wall time since the last packing frame, including drawing, so the readout is the rate actually
+                // achieved. a long gap means packing was paused in between and starts a fresh window
+                const double now = GetTime();
+                if (now - lastPackTime < PACK_RATE_WINDOW) {
+                    rateWindowTime += now - lastPackTime;
+                    rateWindowCandidates += packer.candidateCount - candidatesBefore;
+                    if (rateWindowTime >= PACK_RATE_WINDOW) {
+                        candidatesPerSecond = (float)(rateWindowCandidates / rateWindowTime);
+                        rateWindowTime = 0.0;
+                        rateWindowCandidates = 0;
                     }
                 }
+                lastPackTime = now;
             } break;
 
             case STATE_DONE: {
                 particles_update_draw(particles);
+                if (IsKeyPressed(KEY_TAB)) {
+                    compactCorner = (compactCorner + 1) % 4;
+                }
+                if (IsKeyPressed(KEY_C) && packer.count > 0 && compact_layout(&packer, compactCorner) > 0) {
+                    currentState = STATE_PACKING;
+                    screenShakeIntensity = 4.f;
+                }
                 if (IsKeyPressed(KEY_A) || IsKeyPressed(KEY_R)) {
                     if (IsKeyPressed(KEY_R)) {
                         containerPoly = (Polygon){0};
                     }
                     innerPoly = (Polygon){0};
                     
-                    free(packedShapes);
-                    packedShapes = NULL;
-                    packedShapesCount = 0;
-                    packedShapesCap = 0;
-
-                    containerBounds = (Rectangle){0};
-                    packingCursor = (Vector2){0};
+                    packer_release(&packer);
+                    animStart = 0;
                     
                     containerArea = 0.f;
                     packedTotalArea = 0.f;
                     packingEfficiency = 0.f;
                     
-                    grid_clear();
-                    grid_init();
-                    
                     currentState = STATE_DRAW_CONTAINER;
                 }
             } break;
         }
         
-        for (int i = 0; i < packedShapesCount; i += 1) {
-            if (packedShapes[i].animTimer < 1.f) {
-                packedShapes[i].animTimer += GetFrameTime() * 2.5f;
-                if (packedShapes[i].animTimer > 1.f) {
-                    packedShapes[i].animTimer = 1.f;
-                }
+        const double drawStart = GetTime();
+
+        // shapes are appended and all animate at the same rate, so the ones still popping in are a suffix
+        while (animStart < packer.count && packer.shapes[animStart].animTimer >= 1.f) {
+            animStart += 1;
+        }
+        for (int i = animStart; i < packer.count; i += 1) {
+            packer.shapes[i].animTimer += GetFrameTime() * 2.5f;
+            if (packer.shapes[i].animTimer > 1.f) {
+                packer.shapes[i].animTimer = 1.f;
             }
         }
 
@@ -260,27 +518,17 @@ int main(void) {
         }
 
         if (STATE_PACKING == currentState || STATE_DONE == currentState) {
-            for (int i = 0; i < packedShapesCount; i += 1) {
-                const PackedShape* ps = &packedShapes[i];
-                const float scale = sinf(ps->animTimer * PI * 0.5f);
-                
-                const Vector2 center = get_poly_center(&ps->poly);
-                Polygon scaledPoly = { .vertexCount = ps->poly.vertexCount };
-                for(int j = 0; j < ps->poly.vertexCount; j += 1) {
-                    const Vector2 v = Vector2Scale(Vector2Subtract(ps->poly.vertices[j], center), scale);
-                    scaledPoly.vertices[j] = Vector2Add(v, center);
-                }
-
-                DrawTriangleFan(scaledPoly.vertices, scaledPoly.vertexCount, Fade(ps->color, scale));
-                draw_poly_lines(scaledPoly.vertices, scaledPoly.vertexCount, Fade(DARKGRAY, scale), 1.f);
-            }
+            draw_packed_shapes(&packer);
         }
         
         particles_update_draw(particles);
 
         EndMode2D();
         
-        draw_ui_panel(currentState, packedShapesCount, &posStep, &rotationStep, packingEfficiency);
+        draw_ui_panel(currentState, packer.count, &posStep, &rotationStep, &proxyTolerance, angleMode, compactCorner, packingEfficiency, candidatesPerSecond, positionsPerFrame);
+
+        // the final batch flush and swap in EndDrawing aren't measured, PACK_FRAME_HEADROOM covers them
+        drawSeconds += (GetTime() - drawStart - drawSeconds) * PACK_RATE_SMOOTHING;
         EndDrawing();
     }
     
@@ -289,102 +537,892 @@ int main(void) {
     UnloadSound(packSound);
     CloseAudioDevice();
     
-    grid_clear();
-    free(packedShapes);
+    packer_release(&packer);
     CloseWindow();
     return 0;
 }
 
-static void grid_init(void) {
-    for (int y = 0; y < GRID_ROWS; y += 1) {
-        for (int x = 0; x < GRID_COLS; x += 1) {
-            spatialGrid[y][x].shapeInds = NULL;
-            spatialGrid[y][x].count = 0;
-            spatialGrid[y][x].cap = 0;
-        }
+static void packer_begin(Packer* p, const Polygon* container, const Polygon* inner, float proxyTolerance) {
+    p->isBegun = 1;
+    p->container = *container;
+    p->inner = *inner;
+    p->containerBounds = get_poly_bounds(container);
+    p->cursor = (Vector2){ p->containerBounds.x, p->containerBounds.y };
+    // detected here rather than when the shape is drawn, so batch jobs get it too
+    p->symmetryOrder = poly_rotational_symmetry(inner, SYMMETRY_TOLERANCE * poly_radius(inner));
+    p->sweepStep = 0.f;
+    build_collision_proxy(inner, &p->innerProxy, proxyTolerance);
+    build_collision_core(inner, &p->innerCore, CORE_MAX_VERTICES);
+    grid_init(p, p->containerBounds);
+
+    // cursor positions inside a packed shape can only be skipped if every candidate
+    // covers its own pivot, and the cell raster is only exact for convex shapes
+    p->occupancyEnabled = is_poly_convex(inner) &&
+                          CheckCollisionPointPoly(Vector2Zero(), inner->vertices, inner->vertexCount);
+}
+
+// tries one cursor position and advances the cursor, posStep, rotationStep and angleMode are read on every call.
+// no new candidate is tested once candidateCount reaches candidateLimit, the position is left half done
+// instead and the next call picks its sweep up where this one stopped
+static PackStep packer_step(Packer* p, long long candidateLimit) {
+    const Rectangle scan = p->isRefilling ? p->refillRegions[p->refillInd].bounds : p->containerBounds;
+    if (p->cursor.y >= scan.y + scan.height) {
+        if (p->isRefilling && p->refillInd + 1 < p->refillCount) {
+            p->refillInd += 1;
+            p->cursor = packer_lattice_start(p, p->refillRegions[p->refillInd].bounds);
+            return PACK_STEP_EMPTY;
+        }
+        p->isRefilling = 0;
+        return PACK_STEP_FINISHED;
+    }
+
+    float freeX = p->occupancyEnabled ? occupancy_next_free_x(p, p->cursor) : p->cursor.x;
+    if (p->isRefilling) {
+        freeX = MAX(freeX, grid_next_opened_x(p, p->cursor));
+    }
+    const char isCovered = freeX > p->cursor.x;
+
+    // a half done position can only carry on in the mode it was started in
+    if (p->sweepMode != p->angleMode) {
+        p->sweepInd = 0;
+        p->sweepMode = p->angleMode;
+    }
+
+    const float sweepLimit = 360.f / p->symmetryOrder;
+    PackedShape candidate = {0};
+    SweepResult result = SWEEP_NONE;
+    if (!isCovered && ANGLE_MODE_ANALYTIC == p->angleMode) {
+        result = find_analytic_angle(p, p->cursor, sweepLimit * DEG2RAD, candidateLimit, &candidate);
+    }
+    if (!isCovered && ANGLE_MODE_SAMPLED == p->angleMode && p->rotationStep != p->sweepStep) {
+        build_sweep_angles(p);
+    }
+    // sweepInd is the next sweepAngles entry to try
+    while (!isCovered && ANGLE_MODE_SAMPLED == p->angleMode && p->sweepInd < p->sweepCount) {
+        if (p->candidateCount >= candidateLimit) {
+            result = SWEEP_PAUSED;
+            break;
+        }
+
+        place_candidate(p, p->sweepAngles[p->sweepInd] * DEG2RAD, p->cursor, &candidate);
+        p->sweepInd += 1;
+        if (is_candidate_valid(p, &candidate)) {
+            result = SWEEP_FOUND;
+            break;
+        }
+    }
+
+    if (SWEEP_PAUSED == result) {
+        return PACK_STEP_PAUSED;
+    }
+    p->sweepInd = 0;
+
+    char isPlaced = 0;
+    if (SWEEP_FOUND == result) {
+        if (p->count >= p->cap) {
+            p->cap = (0 == p->cap) ? 16 : p->cap * 2;
+            p->shapes = realloc(p->shapes, p->cap * sizeof(PackedShape));
+        }
+
+        if (p->shapes) {
+            p->shapes[p->count] = candidate;
+            grid_add_shape(p, p->count, &candidate.poly);
+            p->count += 1;
+            isPlaced = 1;
+        }
+    }
+
+    // jump straight to the first position past the covered run, staying on the posStep lattice
+    p->cursor.x += isCovered ? ceilf((freeX - p->cursor.x) / p->posStep) * p->posStep : p->posStep;
+    if (p->cursor.x >= scan.x + scan.width) {
+        p->cursor.x = packer_lattice_start(p, scan).x;
+        p->cursor.y += p->posStep;
+    }
+
+    return isPlaced ? PACK_STEP_PLACED : PACK_STEP_EMPTY;
+}
+
+// first cursor position inside area on the posStep lattice anchored at the container's corner
+static Vector2 packer_lattice_start(const Packer* p, Rectangle area) {
+    const Rectangle b = p->containerBounds;
+    return (Vector2){
+        b.x + MAX(0.f, ceilf((area.x - b.x) / p->posStep)) * p->posStep,
+        b.y + MAX(0.f, ceilf((area.y - b.y) / p->posStep)) * p->posStep
+    };
+}
+
+static void packer_release(Packer* p) {
+    grid_clear(p);
+    free(p->shapes);
+    free(p->compactOrder);
+    free(p->sweepAngles);
+    free(p->nearbyInds);
+    free(p->refillRegions);
+    memset(p, 0, sizeof(Packer));
+}
+
+// the full 0..360 sweep in rotationStep increments, folded into [0, 360/symmetryOrder). once the
+// steps add up to a multiple of the fold every later sample repeats an earlier orientation, so the
+// list stops there. when rotationStep divides the fold this is just the first 360/symmetryOrder degrees
+static void build_sweep_angles(Packer* p) {
+    const float fold = 360.f / p->symmetryOrder;
+    p->sweepCount = 0;
+    p->sweepStep = p->rotationStep;
+    p->sweepInd = 0; // a half done position starts over with the new angles
+
+    // same accumulation as a plain full sweep, so symmetryOrder 1 samples exactly the same angles. the
+    // float sum drifts far more than the tolerance over a fine sweep, so the return to the fold is
+    // decided from the sample index instead
+    const double tolerance = SWEEP_ANGLE_EPSILON * p->rotationStep;
+    int sampleInd = 0;
+    for (float angle = 0.f; angle < 360.f; angle += p->rotationStep, sampleInd += 1) {
+        const double exact = fmod((double)sampleInd * p->rotationStep, fold);
+        if (p->symmetryOrder > 1 && sampleInd > 0 && (exact < tolerance || fold - exact < tolerance)) {
+            break;
+        }
+
+        const float folded = fmodf(angle, fold);
+
+        if (p->sweepCount >= p->sweepCap) {
+            p->sweepCap = (0 == p->sweepCap) ? 64 : p->sweepCap * 2;
+            p->sweepAngles = realloc(p->sweepAngles, p->sweepCap * sizeof(float));
+            if (!p->sweepAngles) {
+                p->sweepCount = 0;
+                p->sweepCap = 0;
+                return;
+            }
+        }
+        p->sweepAngles[p->sweepCount] = folded;
+        p->sweepCount += 1;
+    }
+}
+
+#ifndef __EMSCRIPTEN__
+static int run_batch(const char* jobsPath, int threadCount, const char* outDir) {
+    FILE* file = fopen(jobsPath, "r");
+    if (!file) {
+        fprintf(stderr, "batch: can't open %s\n", jobsPath);
+        return 1;
+    }
+
+    BatchQueue queue = { .outDir = outDir };
+    int cap = 0;
+    int lineNum = 0;
+    char line[BATCH_MAX_LINE];
+    while (fgets(line, sizeof(line), file)) {
+        lineNum += 1;
+
+        const char* first = line + strspn(line, " \t\r\n");
+        if ('\0' == *first || '#' == *first) {
+            continue;
+        }
+
+        if (queue.count >= cap) {
+            cap = (0 == cap) ? 16 : cap * 2;
+            queue.jobs = realloc(queue.jobs, cap * sizeof(BatchJob));
+            if (!queue.jobs) {
+                fclose(file);
+                return 1;
+            }
+        }
+
+        if (!parse_batch_job(line, &queue.jobs[queue.count])) {
+            fprintf(stderr, "batch: skipping malformed job on line %d\n", lineNum);
+            continue;
+        }
+
+        // the name is the layout's file name, a second job with it would overwrite the first one's
+        char isDuplicate = 0;
+        for (int i = 0; i < queue.count && !isDuplicate; i += 1) {
+            isDuplicate = 0 == strcmp(queue.jobs[i].name, queue.jobs[queue.count].name);
+        }
+        if (isDuplicate) {
+            fprintf(stderr, "batch: skipping job on line %d, the name %s is already taken\n", lineNum, queue.jobs[queue.count].name);
+            continue;
+        }
+        queue.count += 1;
+    }
+    fclose(file);
+
+    pthread_mutex_init(&queue.lock, NULL);
+    printf("name,count,efficiency,runtime_ms,layout\n");
+    fflush(stdout);
+
+    pthread_t threads[BATCH_MAX_THREADS];
+    const int workerCount = MIN(threadCount, queue.count);
+    int startedCount = 0;
+    for (int i = 0; i < workerCount; i += 1) {
+        if (0 != pthread_create(&threads[startedCount], NULL, batch_worker, &queue)) {
+            break;
+        }
+        startedCount += 1;
+    }
+    if (0 == startedCount && queue.count > 0) {
+        batch_worker(&queue);
+    }
+    for (int i = 0; i < startedCount; i += 1) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&queue.lock);
+    free(queue.jobs);
+    return 0;
+}
+
+// name posStep rotationStep sampled|analytic[+compact] | x,y x,y ... | x,y x,y ...
+static char parse_batch_job(char* line, BatchJob* job) {
+    memset(job, 0, sizeof(BatchJob));
+
+    char* save = NULL;
+    char* header = strtok_r(line, "|", &save);
+    char* containerText = strtok_r(NULL, "|", &save);
+    char* innerText = strtok_r(NULL, "|", &save);
+    if (!header || !containerText || !innerText) {
+        return 0;
+    }
+
+    char strategy[32] = {0};
+    if (4 != sscanf(header, "%63s %f %f %31s", job->name, &job->posStep, &job->rotationStep, strategy)) {
+        return 0;
+    }
+    if (job->posStep <= 0.f) {
+        return 0;
+    }
+
+    // the name becomes outDir/name.layout, so it can't leave outDir, and it is a CSV column
+    if (strpbrk(job->name, "/\\,") || 0 == strcmp(job->name, ".") || 0 == strcmp(job->name, "..")) {
+        return 0;
+    }
+
+    char* plus = strchr(strategy, '+');
+    if (plus) {
+        if (0 != strcmp(plus, "+compact")) {
+            return 0;
+        }
+        *plus = '\0';
+        job->isCompacting = 1;
+    }
+    if (0 == strcmp(strategy, "sampled")) {
+        job->angleMode = ANGLE_MODE_SAMPLED;
+    } else if (0 == strcmp(strategy, "analytic")) {
+        job->angleMode = ANGLE_MODE_ANALYTIC;
+    } else {
+        return 0;
+    }
+
+    // the analytic mode never reads rotationStep
+    if (ANGLE_MODE_SAMPLED == job->angleMode && job->rotationStep <= 0.f) {
+        return 0;
+    }
+
+    if (!parse_poly(containerText, &job->container) || !parse_poly(innerText, &job->inner)) {
+        return 0;
+    }
+
+    ensure_winding(&job->container);
+    ensure_winding(&job->inner);
+    const Vector2 center = get_poly_center(&job->inner);
+    for (int i = 0; i < job->inner.vertexCount; i += 1) {
+        job->inner.vertices[i] = Vector2Subtract(job->inner.vertices[i], center);
+    }
+    return 1;
+}
+
+static char parse_poly(char* text, Polygon* poly) {
+    *poly = (Polygon){ .vertexCount = 0, .isClosed = 1 };
+
+    char* cur = text;
+    while (1) {
+        char* end = NULL;
+        const float x = strtof(cur, &end);
+        if (end == cur) {
+            break;
+        }
+        if (',' != *end) {
+            return 0;
+        }
+        cur = end + 1;
+        const float y = strtof(cur, &end);
+        if (end == cur || poly->vertexCount >= MAX_VERTICES) {
+            return 0;
+        }
+        cur = end;
+
+        poly->vertices[poly->vertexCount] = (Vector2){ x, y };
+        poly->vertexCount += 1;
+    }
+
+    // only whitespace may follow the last vertex
+    if (poly->vertexCount < 3 || '\0' != cur[strspn(cur, " \t\r\n")]) {
+        return 0;
+    }
+
+    // a flat polygon would "pack" endlessly at 0% efficiency, written so NaN coordinates fail too
+    const Rectangle bounds = get_poly_bounds(poly);
+    return fabsf(poly_area(poly)) > BATCH_MIN_AREA_FRACTION * bounds.width * bounds.height;
+}
+
+static void* batch_worker(void* arg) {
+    BatchQueue* queue = arg;
+
+    // one engine per worker, run_batch_job releases its buffers after every job
+    Packer* p = calloc(1, sizeof(Packer));
+    if (!p) {
+        return NULL;
+    }
+
+    while (1) {
+        pthread_mutex_lock(&queue->lock);
+        const int jobInd = queue->next;
+        queue->next += 1;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (jobInd >= queue->count) {
+            break;
+        }
+        run_batch_job(p, &queue->jobs[jobInd], queue);
+    }
+
+    free(p);
+    return NULL;
+}
+
+static void run_batch_job(Packer* p, const BatchJob* job, BatchQueue* queue) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    packer_begin(p, &job->container, &job->inner, BATCH_PROXY_TOLERANCE);
+    p->posStep = job->posStep;
+    p->rotationStep = job->rotationStep;
+    p->angleMode = job->angleMode;
+
+    while (PACK_STEP_FINISHED != packer_step(p, LLONG_MAX)) { }
+    if (job->isCompacting && p->count > 0 && compact_layout(p, CORNER_TOP_LEFT) > 0) {
+        while (PACK_STEP_FINISHED != packer_step(p, LLONG_MAX)) { }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double runtimeMs = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+
+    const float containerArea = fabsf(poly_area(&job->container));
+    const float efficiency = (containerArea > 0) ? (p->count * fabsf(poly_area(&job->inner)) / containerArea) * 100.f : 0.f;
+
+    // one packed shape per line, vertices as x,y pairs
+    char layoutPath[1024];
+    snprintf(layoutPath, sizeof(layoutPath), "%s/%s.layout", queue->outDir, job->name);
+    FILE* layout = fopen(layoutPath, "w");
+    if (layout) {
+        for (int i = 0; i < p->count; i += 1) {
+            const Polygon* poly = &p->shapes[i].poly;
+            for (int v = 0; v < poly->vertexCount; v += 1) {
+                fprintf(layout, (v > 0) ? " %.3f,%.3f" : "%.3f,%.3f", poly->vertices[v].x, poly->vertices[v].y);
+            }
+            fputc('\n', layout);
+        }
+        fclose(layout);
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    if (!layout) {
+        fprintf(stderr, "batch: can't write %s\n", layoutPath);
+    }
+    printf("%s,%d,%.2f,%.1f,%s\n", job->name, p->count, efficiency, runtimeMs, layout ? layoutPath : "");
+    fflush(stdout);
+    pthread_mutex_unlock(&queue->lock);
+
+    packer_release(p);
+}
+#endif
+
+static void grid_init(Packer* p, Rectangle bounds) {
+    p->gridOrigin = (Vector2){ bounds.x, bounds.y };
+    p->gridCols = (int)(bounds.width / GRID_CELL_SIZE) + 1;
+    p->gridRows = (int)(bounds.height / GRID_CELL_SIZE) + 1;
+    p->grid = calloc(p->gridCols * p->gridRows, sizeof(GridCell));
+    if (!p->grid) {
+        p->gridCols = p->gridRows = 0;
+    }
+    occupancy_init(p, bounds);
+}
+
+static void grid_clear(Packer* p) {
+    for (int i = 0; i < p->gridCols * p->gridRows; i += 1) {
+        if (p->grid[i].shapeInds) {
+            free(p->grid[i].shapeInds);
+        }
+    }
+    free(p->grid);
+    p->grid = NULL;
+    p->gridCols = p->gridRows = 0;
+
+    free(p->checkedStamps);
+    p->checkedStamps = NULL;
+    p->checkedCap = 0;
+    p->checkStamp = 0;
+
+    occupancy_clear(p);
+}
+
+static void grid_cell_range(const Packer* p, Rectangle bounds, int* minX, int* minY, int* maxX, int* maxY) {
+    *minX = MAX(0, (int)floorf((bounds.x - p->gridOrigin.x) / GRID_CELL_SIZE));
+    *minY = MAX(0, (int)floorf((bounds.y - p->gridOrigin.y) / GRID_CELL_SIZE));
+    *maxX = MIN(p->gridCols - 1, (int)floorf((bounds.x + bounds.width - p->gridOrigin.x) / GRID_CELL_SIZE));
+    *maxY = MIN(p->gridRows - 1, (int)floorf((bounds.y + bounds.height - p->gridOrigin.y) / GRID_CELL_SIZE));
+}
+
+// new id for a grid query, so shapes spanning several cells are only visited once without clearing anything
+static unsigned int grid_next_stamp(Packer* p) {
+    p->checkStamp += 1;
+    if (0 == p->checkStamp) {
+        memset(p->checkedStamps, 0, p->checkedCap * sizeof(unsigned int));
+        p->checkStamp = 1;
+    }
+    return p->checkStamp;
+}
+
+static void grid_add_shape(Packer* p, int shapeInd, const Polygon* poly) {
+    if (shapeInd >= p->checkedCap) {
+        const int newCap = MAX(shapeInd + 1, (0 == p->checkedCap) ? 16 : p->checkedCap * 2);
+        unsigned int* stamps = realloc(p->checkedStamps, newCap * sizeof(unsigned int));
+        if (!stamps) {
+            return;
+        }
+        memset(stamps + p->checkedCap, 0, (newCap - p->checkedCap) * sizeof(unsigned int));
+        p->checkedStamps = stamps;
+        p->checkedCap = newCap;
+    }
+
+    Rectangle bounds = get_poly_bounds(poly);
+    int minX, minY, maxX, maxY;
+    grid_cell_range(p, bounds, &minX, &minY, &maxX, &maxY);
+    p->grid[minY * p->gridCols + minX].cornerCount += 1;
+
+    for (int y = minY; y <= maxY; y += 1) {
+        for (int x = minX; x <= maxX; x += 1) {
+            GridCell* cell = &p->grid[y * p->gridCols + x];
+            if (cell->count >= cell->cap) {
+                cell->cap = (0 == cell->cap) ? 8 : cell->cap * 2;
+                cell->shapeInds = realloc(cell->shapeInds, cell->cap * sizeof(int));
+            }
+            if (cell->shapeInds) {
+                cell->shapeInds[cell->count] = shapeInd;
+                cell->count += 1;
+            }
+        }
+    }
+
+    if (p->occupancyEnabled) {
+        occupancy_add_shape(p, poly);
+    }
+}
+
+static void grid_remove_shape(Packer* p, int shapeInd, Rectangle bounds) {
+    int minX, minY, maxX, maxY;
+    grid_cell_range(p, bounds, &minX, &minY, &maxX, &maxY);
+    p->grid[minY * p->gridCols + minX].cornerCount -= 1;
+
+    for (int y = minY; y <= maxY; y += 1) {
+        for (int x = minX; x <= maxX; x += 1) {
+            GridCell* cell = &p->grid[y * p->gridCols + x];
+            for (int i = 0; i < cell->count; i += 1) {
+                if (cell->shapeInds[i] == shapeInd) {
+                    cell->count -= 1;
+                    cell->shapeInds[i] = cell->shapeInds[cell->count];
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// pos.x if the cell under pos was opened up by compaction or is empty, otherwise the x of the next such cell in the row.
+// the refill only scans inside opened regions, so empty cells outside the container are never reached
+static float grid_next_opened_x(const Packer* p, Vector2 pos) {
+    const int row = (int)floorf((pos.y - p->gridOrigin.y) / GRID_CELL_SIZE);
+    const int col = (int)floorf((pos.x - p->gridOrigin.x) / GRID_CELL_SIZE);
+    if (row < 0 || row >= p->gridRows || col < 0 || col >= p->gridCols) {
+        return pos.x;
+    }
+
+    for (int x = col; x < p->gridCols; x += 1) {
+        const GridCell* cell = &p->grid[row * p->gridCols + x];
+        if (cell->isOpened || 0 == cell->count) {
+            return (x == col) ? pos.x : p->gridOrigin.x + x * (float)GRID_CELL_SIZE;
+        }
+    }
+    return p->gridOrigin.x + p->gridCols * (float)GRID_CELL_SIZE;
+}
+
+// groups opened cells into 4-connected regions, ranked by how many of their cells are now empty
+static void grid_find_opened_regions(Packer* p) {
+    p->refillCount = 0;
+
+    const int cellCount = p->gridCols * p->gridRows;
+    int* stack = malloc(cellCount * sizeof(int));
+    char* isVisited = calloc(cellCount, sizeof(char));
+    if (!stack || !isVisited) {
+        free(stack);
+        free(isVisited);
+        return;
+    }
+
+    for (int seed = 0; seed < cellCount; seed += 1) {
+        if (!p->grid[seed].isOpened || isVisited[seed]) {
+            continue;
+        }
+
+        RefillRegion region = {0};
+        int minX = p->gridCols, minY = p->gridRows, maxX = -1, maxY = -1;
+        int top = 0;
+        stack[top] = seed;
+        top += 1;
+        isVisited[seed] = 1;
+        while (top > 0) {
+            top -= 1;
+            const int ind = stack[top];
+            const int x = ind % p->gridCols;
+            const int y = ind / p->gridCols;
+            minX = MIN(minX, x); maxX = MAX(maxX, x);
+            minY = MIN(minY, y); maxY = MAX(maxY, y);
+            region.cellCount += 1;
+            region.freeCells += (0 == p->grid[ind].count) ? 1 : 0;
+
+            const int neighbours[4][2] = { { x - 1, y }, { x + 1, y }, { x, y - 1 }, { x, y + 1 } };
+            for (int n = 0; n < 4; n += 1) {
+                const int nx = neighbours[n][0];
+                const int ny = neighbours[n][1];
+                if (nx < 0 || nx >= p->gridCols || ny < 0 || ny >= p->gridRows) {
+                    continue;
+                }
+
+                const int nInd = ny * p->gridCols + nx;
+                if (p->grid[nInd].isOpened && !isVisited[nInd]) {
+                    isVisited[nInd] = 1;
+                    stack[top] = nInd;
+                    top += 1;
+                }
+            }
+        }
+
+        region.bounds = (Rectangle){
+            p->gridOrigin.x + minX * (float)GRID_CELL_SIZE, p->gridOrigin.y + minY * (float)GRID_CELL_SIZE,
+            (maxX - minX + 1) * (float)GRID_CELL_SIZE, (maxY - minY + 1) * (float)GRID_CELL_SIZE
+        };
+
+        if (p->refillCount >= p->refillCap) {
+            p->refillCap = (0 == p->refillCap) ? 16 : p->refillCap * 2;
+            p->refillRegions = realloc(p->refillRegions, p->refillCap * sizeof(RefillRegion));
+            if (!p->refillRegions) {
+                p->refillCap = 0;
+                p->refillCount = 0;
+                break;
+            }
+        }
+        p->refillRegions[p->refillCount] = region;
+        p->refillCount += 1;
+    }
+
+    free(stack);
+    free(isVisited);
+    if (p->refillCount > 1) {
+        qsort(p->refillRegions, p->refillCount, sizeof(RefillRegion), compare_refill_regions);
+    }
+}
+
+static int compare_refill_regions(const void* a, const void* b) {
+    const RefillRegion* ra = a;
+    const RefillRegion* rb = b;
+    if (ra->freeCells != rb->freeCells) {
+        return rb->freeCells - ra->freeCells;
+    }
+    return rb->cellCount - ra->cellCount;
+}
+
+static void occupancy_init(Packer* p, Rectangle bounds) {
+    p->occCellSize = OCC_CELL_SIZE;
+    while ((bounds.width / p->occCellSize + 1.f) * (bounds.height / p->occCellSize + 1.f) > OCC_MAX_CELLS) {
+        p->occCellSize *= 2.f;
+    }
+
+    p->occOrigin = (Vector2){ bounds.x, bounds.y };
+    p->occCols = (int)(bounds.width / p->occCellSize) + 1;
+    p->occRows = (int)(bounds.height / p->occCellSize) + 1;
+    p->occupancy = calloc(p->occCols * p->occRows, sizeof(char));
+    p->occupancyRows = calloc(p->occRows, sizeof(OccupancyRow));
+    if (!p->occupancy || !p->occupancyRows) {
+        occupancy_clear(p);
+        return;
+    }
+
+    for (int y = 0; y < p->occRows; y += 1) {
+        occupancy_rebuild_row(p, y);
+    }
+}
+
+static void occupancy_clear(Packer* p) {
+    for (int y = 0; p->occupancyRows && y < p->occRows; y += 1) {
+        if (p->occupancyRows[y].freeSpans) {
+            free(p->occupancyRows[y].freeSpans);
+        }
+    }
+    free(p->occupancyRows);
+    free(p->occupancy);
+    p->occupancyRows = NULL;
+    p->occupancy = NULL;
+    p->occCols = p->occRows = 0;
+}
+
+// uncovers every cell, keeping the raster's size and allocations
+static void occupancy_reset(Packer* p) {
+    memset(p->occupancy, 0, p->occCols * p->occRows * sizeof(char));
+    for (int y = 0; y < p->occRows; y += 1) {
+        occupancy_rebuild_row(p, y);
+    }
+}
+
+// marks every raster cell that lies entirely inside poly, poly must be convex
+static void occupancy_add_shape(Packer* p, const Polygon* poly) {
+    const Rectangle bounds = get_poly_bounds(poly);
+    const int minY = MAX(0, (int)floorf((bounds.y - p->occOrigin.y) / p->occCellSize));
+    const int maxY = MIN(p->occRows - 1, (int)floorf((bounds.y + bounds.height - p->occOrigin.y) / p->occCellSize));
+
+    for (int y = minY; y <= maxY; y += 1) {
+        // a cell is inside a convex poly iff its top and bottom edges are
+        float topMin, topMax, botMin, botMax;
+        if (!poly_scanline_span(poly, p->occOrigin.y + y * p->occCellSize, &topMin, &topMax) ||
+            !poly_scanline_span(poly, p->occOrigin.y + (y + 1) * p->occCellSize, &botMin, &botMax)
+        ) {
+            continue;
+        }
+
+        const int minX = MAX(0, (int)ceilf((MAX(topMin, botMin) - p->occOrigin.x) / p->occCellSize));
+        const int maxX = MIN(p->occCols, (int)floorf((MIN(topMax, botMax) - p->occOrigin.x) / p->occCellSize));
+        if (minX >= maxX) {
+            continue;
+        }
+
+        memset(&p->occupancy[y * p->occCols + minX], 1, maxX - minX);
+        occupancy_rebuild_row(p, y);
+    }
+}
+
+static void occupancy_rebuild_row(Packer* p, int row) {
+    OccupancyRow* r = &p->occupancyRows[row];
+    const char* cells = &p->occupancy[row * p->occCols];
+    r->count = 0;
+
+    for (int x = 0; x < p->occCols; x += 1) {
+        if (cells[x]) {
+            continue;
+        }
+
+        const int start = x;
+        while (x < p->occCols && !cells[x]) {
+            x += 1;
+        }
+
+        if (r->count >= r->cap) {
+            r->cap = (0 == r->cap) ? 8 : r->cap * 2;
+            r->freeSpans = realloc(r->freeSpans, r->cap * 2 * sizeof(int));
+        }
+        if (r->freeSpans) {
+            r->freeSpans[r->count * 2] = start;
+            r->freeSpans[r->count * 2 + 1] = x;
+            r->count += 1;
+        }
+    }
+}
+
+// pos.x if the cell under pos is not fully covered, otherwise the x where the covered run ends
+static float occupancy_next_free_x(const Packer* p, Vector2 pos) {
+    const int row = (int)floorf((pos.y - p->occOrigin.y) / p->occCellSize);
+    const int col = (int)floorf((pos.x - p->occOrigin.x) / p->occCellSize);
+    if (row < 0 || row >= p->occRows || col < 0 || col >= p->occCols || !p->occupancy[row * p->occCols + col]) {
+        return pos.x;
+    }
+
+    // first free span starting after col
+    const OccupancyRow* r = &p->occupancyRows[row];
+    int lo = 0, hi = r->count;
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        if (r->freeSpans[mid * 2] <= col) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return p->occOrigin.x + (lo < r->count ? r->freeSpans[lo * 2] : p->occCols) * p->occCellSize;
+}
+
+static char does_shape_overlap_packed(Packer* p, const PackedShape* candidate) {
+    if (0 == p->count) {
+        return 0;
+    }
+
+    const unsigned int stamp = grid_next_stamp(p);
+
+    int minX, minY, maxX, maxY;
+    grid_cell_range(p, candidate->bounds, &minX, &minY, &maxX, &maxY);
+
+    for (int y = minY; y <= maxY; y += 1) {
+        for (int x = minX; x <= maxX; x += 1) {
+            GridCell* cell = &p->grid[y * p->gridCols + x];
+            for (int i = 0; i < cell->count; i += 1) {
+                const int shapeInd = cell->shapeInds[i];
+                if (stamp == p->checkedStamps[shapeInd]) {
+                    continue;
+                }
+                
+                p->checkedStamps[shapeInd] = stamp;
+
+                const PackedShape* packed = &p->shapes[shapeInd];
+                if (!CheckCollisionRecs(candidate->bounds, packed->bounds)) {
+                    continue;
+                }
+
+                // the exact test reports a collision whenever the shapes' hulls overlap, and
+                // cores lie inside those hulls, so overlapping cores settle it cheaply
+                if (candidate->core.vertexCount > 0 && packed->core.vertexCount > 0 &&
+                    check_poly_collisions(&candidate->core, &packed->core)
+                ) {
+                    return 1;
+                }
+
+                if (check_poly_collisions(&candidate->poly, &packed->poly)) {
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// gravity-style pass: shapes nearest the corner go first, each sliding vertically then horizontally
+// toward it in shrinking steps for as long as it stays valid. returns how many shapes moved
+static int compact_layout(Packer* p, Corner corner) {
+    const Vector2 dir = {
+        (CORNER_TOP_LEFT == corner || CORNER_BOTTOM_LEFT == corner) ? -1.f : 1.f,
+        (CORNER_TOP_LEFT == corner || CORNER_TOP_RIGHT == corner) ? -1.f : 1.f
+    };
+
+    p->compactOrder = realloc(p->compactOrder, p->count * sizeof(CompactEntry));
+    if (!p->compactOrder) {
+        return 0;
+    }
+
+    for (int i = 0; i < p->count; i += 1) {
+        const Rectangle b = p->shapes[i].bounds;
+        p->compactOrder[i] = (CompactEntry){
+            .shapeInd = i,
+            .key = -((b.x + b.width * 0.5f) * dir.x + (b.y + b.height * 0.5f) * dir.y)
+        };
+    }
+    qsort(p->compactOrder, p->count, sizeof(CompactEntry), compare_compact_order);
+
+    for (int i = 0; i < p->gridCols * p->gridRows; i += 1) {
+        p->grid[i].compactCount = p->grid[i].count;
     }
-}
 
-static void grid_clear(void) {
-    for (int y = 0; y < GRID_ROWS; y += 1) {
-        for (int x = 0; x < GRID_COLS; x += 1) {
-            if (spatialGrid[y][x].shapeInds) {
-                free(spatialGrid[y][x].shapeInds);
+    // the raster is rebuilt from scratch afterwards, so don't stamp every shape into it twice
+    const char wasOccupancyEnabled = p->occupancyEnabled;
+    p->occupancyEnabled = 0;
+
+    int movedCount = 0;
+    for (int k = 0; k < p->count; k += 1) {
+        const int ind = p->compactOrder[k].shapeInd;
+        PackedShape* shape = &p->shapes[ind];
+
+        // take it out of the grid so it doesn't collide with itself
+        grid_remove_shape(p, ind, shape->bounds);
+
+        char hasMoved = 0;
+        for (int round = 0; round < 4; round += 1) {
+            char movedThisRound = 0;
+            for (int axis = 0; axis < 2; axis += 1) {
+                for (float step = COMPACT_STEP_MAX; step >= COMPACT_STEP_MIN; step *= 0.5f) {
+                    const Vector2 delta = (0 == axis) ? (Vector2){ 0.f, dir.y * step } : (Vector2){ dir.x * step, 0.f };
+                    while (try_translate_shape(p, shape, delta)) {
+                        movedThisRound = 1;
+                    }
+                }
             }
+            if (!movedThisRound) {
+                break;
+            }
+            hasMoved = 1;
+        }
+
+        if (hasMoved) {
+            movedCount += 1;
         }
+
+        grid_add_shape(p, ind, &shape->poly);
     }
-}
 
-static void grid_add_shape(int shapeInd, const Polygon* poly) {
-    Rectangle bounds = get_poly_bounds(poly);
-    const int minX = MAX(0, (int)floorf(bounds.x / GRID_CELL_SIZE));
-    const int minY = MAX(0, (int)floorf(bounds.y / GRID_CELL_SIZE));
-    const int maxX = MIN(GRID_COLS - 1, (int)floorf((bounds.x + bounds.width) / GRID_CELL_SIZE));
-    const int maxY = MIN(GRID_ROWS - 1, (int)floorf((bounds.y + bounds.height) / GRID_CELL_SIZE));
+    // nearly every shape moves a little, so only cells that ended up touching fewer shapes count as opened.
+    // marking every cell a moved shape used to touch would open up the whole sheet
+    for (int i = 0; i < p->gridCols * p->gridRows; i += 1) {
+        p->grid[i].isOpened = p->grid[i].count < p->grid[i].compactCount;
+    }
 
-    for (int y = minY; y <= maxY; y += 1) {
-        for (int x = minX; x <= maxX; x += 1) {
-            GridCell* cell = &spatialGrid[y][x];
-            if (cell->count >= cell->cap) {
-                cell->cap = (0 == cell->cap) ? 8 : cell->cap * 2;
-                cell->shapeInds = realloc(cell->shapeInds, cell->cap * sizeof(int));
-            }
-            if (cell->shapeInds) {
-                cell->shapeInds[cell->count] = shapeInd;
-                cell->count += 1;
-            }
+    // moved shapes left stale covered cells behind, which would hide exactly the space that opened up
+    p->occupancyEnabled = wasOccupancyEnabled;
+    occupancy_reset(p);
+    if (p->occupancyEnabled) {
+        for (int i = 0; i < p->count; i += 1) {
+            occupancy_add_shape(p, &p->shapes[i].poly);
         }
     }
+
+    // packer_step then refills the space that opened up, biggest patches first
+    grid_find_opened_regions(p);
+    if (p->refillCount > 0) {
+        p->isRefilling = 1;
+        p->refillInd = 0;
+        p->cursor = packer_lattice_start(p, p->refillRegions[0].bounds);
+    }
+
+    return movedCount;
 }
 
-static char does_shape_overlap_packed(const Polygon* shape, const PackedShape* packedShapes, int packedCount) {
-    if (0 == packedCount) {
-        return 0;
+static char try_translate_shape(Packer* p, PackedShape* shape, Vector2 delta) {
+    PackedShape moved = *shape;
+    for (int i = 0; i < moved.poly.vertexCount; i += 1) {
+        moved.poly.vertices[i] = Vector2Add(moved.poly.vertices[i], delta);
     }
-    if (packedCount > MAX_PACKABLE_SHAPES) {
-        return 1;
+    for (int i = 0; i < moved.proxy.vertexCount; i += 1) {
+        moved.proxy.vertices[i] = Vector2Add(moved.proxy.vertices[i], delta);
     }
+    for (int i = 0; i < moved.core.vertexCount; i += 1) {
+        moved.core.vertices[i] = Vector2Add(moved.core.vertices[i], delta);
+    }
+    moved.bounds = get_poly_bounds(&moved.poly);
 
-    memset(checkedInds, 0, packedCount * sizeof(char));
-
-    Rectangle candidateBox = get_poly_bounds(shape);
-    const int minX = MAX(0, (int)floorf(candidateBox.x / GRID_CELL_SIZE));
-    const int minY = MAX(0, (int)floorf(candidateBox.y / GRID_CELL_SIZE));
-    const int maxX = MIN(GRID_COLS - 1, (int)floorf((candidateBox.x + candidateBox.width) / GRID_CELL_SIZE));
-    const int maxY = MIN(GRID_ROWS - 1, (int)floorf((candidateBox.y + candidateBox.height) / GRID_CELL_SIZE));
+    if (!is_candidate_valid(p, &moved)) {
+        return 0;
+    }
 
-    for (int y = minY; y <= maxY; y += 1) {
-        for (int x = minX; x <= maxX; x += 1) {
-            GridCell* cell = &spatialGrid[y][x];
-            for (int i = 0; i < cell->count; i += 1) {
-                const int shapeInd = cell->shapeInds[i];
-                if (checkedInds[shapeInd]) {
-                    continue;
-                }
-                
-                checkedInds[shapeInd] = 1;
+    *shape = moved;
+    return 1;
+}
 
-                const Rectangle packedBox = get_poly_bounds(&packedShapes[shapeInd].poly);
-                if (CheckCollisionRecs(candidateBox, packedBox)) {
-                    if (check_poly_collisions(shape, &packedShapes[shapeInd].poly)) {
-                        return 1;
-                    }
-                }
-            }
-        }
-    }
-    return 0;
+static int compare_compact_order(const void* a, const void* b) {
+    const float ka = ((const CompactEntry*)a)->key;
+    const float kb = ((const CompactEntry*)b)->key;
+    return (ka > kb) - (ka < kb);
 }
 
 static void handle_drawing(Polygon* poly, State* currentState, State nextState, Sound addSound, Sound finishSound, float* containerArea) {
-    const Vector2 mousePos = GetScreenToWorld2D(GetMousePosition(), camera);
-    if (mousePos.x > SCREEN_WIDTH - UI_PANEL_WIDTH) {
+    if (GetMousePosition().x > SCREEN_WIDTH - UI_PANEL_WIDTH) {
         return;
     }
 
+    const Vector2 mousePos = GetScreenToWorld2D(GetMousePosition(), camera);
     if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
         for (int i = 0; i < poly->vertexCount; i += 1) {
-            if (CheckCollisionPointCircle(mousePos, poly->vertices[i], 8.f)) {
+            if (CheckCollisionPointCircle(mousePos, poly->vertices[i], 8.f / camera.zoom)) {
                 draggedVert = i;
                 draggedPoly = poly;
                 break;
@@ -460,31 +1498,137 @@ static void particles_update_draw(Particle particles[MAX_PARTICLES]) {
 }
 
 static void draw_bg_effect(void) {
-    const int gridSize = 40;
     const Color gridColor = GetColor(0x202020FF);
+    float gridSize = 40.f;
+    while (gridSize * camera.zoom < 20.f) {
+        gridSize *= 2.f;
+    }
+
+    const Rectangle view = get_view_bounds();
+    const float startX = (floorf(view.x / gridSize) - 1.f) * gridSize;
+    const float startY = (floorf(view.y / gridSize) - 1.f) * gridSize;
+    for (float x = startX; x < view.x + view.width + gridSize; x += gridSize) {
+        DrawLineV((Vector2){ x, startY }, (Vector2){ x, view.y + view.height + gridSize }, gridColor);
+    }
+    for (float y = startY; y < view.y + view.height + gridSize; y += gridSize) {
+        DrawLineV((Vector2){ startX, y }, (Vector2){ view.x + view.width + gridSize, y }, gridColor);
+    }
+}
+
+// only shapes in grid cells overlapping the view are visited. zoomed far out, shapes turn into
+// plain fills and then into per-tile shading from the cells' corner counts, which never touches a shape
+static void draw_packed_shapes(const Packer* p) {
+    const Rectangle view = get_view_bounds();
+    const float shapePixels = poly_radius(&p->inner) * 2.f * camera.zoom;
+    const float shapeArea = fabsf(poly_area(&p->inner));
+
+    int minX, minY, maxX, maxY;
+    grid_cell_range(p, view, &minX, &minY, &maxX, &maxY);
+
+    if (shapePixels < LOD_TILE_PIXELS) {
+        const int tile = MAX(1, (int)ceilf(LOD_TILE_MIN_PIXELS / (GRID_CELL_SIZE * camera.zoom)));
+        const float tileArea = (float)(tile * GRID_CELL_SIZE) * (tile * GRID_CELL_SIZE);
+        const Color tileColor = { 80, 30, 195, 255 };
+
+        // tiles are anchored to the grid rather than the view so they don't shift while panning
+        for (int ty = minY - minY % tile; ty <= maxY; ty += tile) {
+            for (int tx = minX - minX % tile; tx <= maxX; tx += tile) {
+                int count = 0;
+                for (int y = ty; y < MIN(ty + tile, p->gridRows); y += 1) {
+                    for (int x = tx; x < MIN(tx + tile, p->gridCols); x += 1) {
+                        count += p->grid[y * p->gridCols + x].cornerCount;
+                    }
+                }
+                if (0 == count) {
+                    continue;
+                }
+
+                const Rectangle rec = {
+                    p->gridOrigin.x + tx * GRID_CELL_SIZE, p->gridOrigin.y + ty * GRID_CELL_SIZE,
+                    tile * GRID_CELL_SIZE, tile * GRID_CELL_SIZE
+                };
+                DrawRectangleRec(rec, Fade(tileColor, MIN(1.f, count * shapeArea / tileArea) * 0.6f));
+            }
+        }
+        return;
+    }
+
+    for (int y = minY; y <= maxY; y += 1) {
+        for (int x = minX; x <= maxX; x += 1) {
+            const GridCell* cell = &p->grid[y * p->gridCols + x];
+            for (int i = 0; i < cell->count; i += 1) {
+                const PackedShape* ps = &p->shapes[cell->shapeInds[i]];
+
+                // a shape is listed in every cell it touches, draw it from the first visible one only
+                int shapeMinX, shapeMinY, shapeMaxX, shapeMaxY;
+                grid_cell_range(p, ps->bounds, &shapeMinX, &shapeMinY, &shapeMaxX, &shapeMaxY);
+                if (MAX(shapeMinX, minX) != x || MAX(shapeMinY, minY) != y || !CheckCollisionRecs(view, ps->bounds)) {
+                    continue;
+                }
+
+                if (shapePixels < LOD_FILL_ONLY_PIXELS) {
+                    DrawTriangleFan(ps->poly.vertices, ps->poly.vertexCount, ps->color);
+                    continue;
+                }
+
+                const float scale = sinf(ps->animTimer * PI * 0.5f);
+                
+                const Vector2 center = get_poly_center(&ps->poly);
+                Polygon scaledPoly = { .vertexCount = ps->poly.vertexCount };
+                for(int j = 0; j < ps->poly.vertexCount; j += 1) {
+                    const Vector2 v = Vector2Scale(Vector2Subtract(ps->poly.vertices[j], center), scale);
+                    scaledPoly.vertices[j] = Vector2Add(v, center);
+                }
+
+                DrawTriangleFan(scaledPoly.vertices, scaledPoly.vertexCount, Fade(ps->color, scale));
+                draw_poly_lines(scaledPoly.vertices, scaledPoly.vertexCount, Fade(DARKGRAY, scale), 1.f / camera.zoom);
+            }
+        }
+    }
+}
 
-    for (int i = -gridSize; i < SCREEN_WIDTH; i += gridSize) {
-        DrawLine(i, 0, i, SCREEN_HEIGHT, gridColor);
+// RMB or MMB drag pans, the wheel zooms around the mouse
+static void handle_camera(void) {
+    const Vector2 mouse = GetMousePosition();
+    if (mouse.x > SCREEN_WIDTH - UI_PANEL_WIDTH) {
+        return;
+    }
+
+    if (IsMouseButtonDown(MOUSE_RIGHT_BUTTON) || IsMouseButtonDown(MOUSE_MIDDLE_BUTTON)) {
+        camera.target = Vector2Subtract(camera.target, Vector2Scale(GetMouseDelta(), 1.f / camera.zoom));
     }
-    for (int i = -gridSize; i < SCREEN_HEIGHT; i += gridSize) {
-        DrawLine(0, i, SCREEN_WIDTH, i, gridColor);
+
+    const float wheel = GetMouseWheelMove();
+    if (0.f != wheel) {
+        const Vector2 fromCenter = Vector2Subtract(mouse, viewCenter);
+        const Vector2 anchor = Vector2Add(camera.target, Vector2Scale(fromCenter, 1.f / camera.zoom));
+        camera.zoom = CLAMP(camera.zoom * powf(1.15f, wheel), ZOOM_MIN, ZOOM_MAX);
+        camera.target = Vector2Subtract(anchor, Vector2Scale(fromCenter, 1.f / camera.zoom));
     }
 }
 
+static Rectangle get_view_bounds(void) {
+    const Vector2 topLeft = GetScreenToWorld2D(Vector2Zero(), camera);
+    const Vector2 bottomRight = GetScreenToWorld2D((Vector2){ SCREEN_WIDTH - UI_PANEL_WIDTH, SCREEN_HEIGHT }, camera);
+    return (Rectangle){ topLeft.x, topLeft.y, bottomRight.x - topLeft.x, bottomRight.y - topLeft.y };
+}
+
 static void draw_poly_with_handles(Polygon* poly, Color lineColor, Color handleColor) {
     if (poly->vertexCount < 1) {
         return;
     }
 
-    draw_poly_lines(poly->vertices, poly->vertexCount, lineColor, 2.f);
+    // handles and lines keep their on-screen size at any zoom
+    const float pixel = 1.f / camera.zoom;
+    draw_poly_lines(poly->vertices, poly->vertexCount, lineColor, 2.f * pixel);
     
     const Vector2 mousePos = GetScreenToWorld2D(GetMousePosition(), camera);
     for (int i = 0; i < poly->vertexCount; i += 1) {
         float radius = 5.f;
         Color color = handleColor;
         
-        char isHovered = CheckCollisionPointCircle(mousePos, poly->vertices[i], 8.f) &&
-                         SCREEN_WIDTH - UI_PANEL_WIDTH >= mousePos.x;
+        char isHovered = CheckCollisionPointCircle(mousePos, poly->vertices[i], 8.f * pixel) &&
+                         SCREEN_WIDTH - UI_PANEL_WIDTH >= GetMousePosition().x;
         if (draggedVert == i && draggedPoly == poly) {
             radius = 8.f;
             color = SKYBLUE;
@@ -493,9 +1637,9 @@ static void draw_poly_with_handles(Polygon* poly, Color lineColor, Color handleC
             color = Fade(handleColor, 0.7f);
         }
         
-        DrawCircleV(poly->vertices[i], radius, color);
+        DrawCircleV(poly->vertices[i], radius * pixel, color);
         if (isHovered) {
-            DrawCircleLines(poly->vertices[i].x, poly->vertices[i].y, 8.f, WHITE);
+            DrawCircleLines(poly->vertices[i].x, poly->vertices[i].y, 8.f * pixel, WHITE);
         }
     }
 }
@@ -509,7 +1653,7 @@ static Vector2 get_poly_center(const Polygon* poly) {
     return (Vector2){ bounds.x + bounds.width / 2.f, bounds.y + bounds.height / 2.f };
 }
 
-static void draw_ui_panel(State currentState, int packedCount, float* posStep, float* rotationStep, float efficiency) {
+static void draw_ui_panel(State currentState, int packedCount, float* posStep, float* rotationStep, float* proxyTolerance, AngleMode angleMode, Corner compactCorner, float efficiency, float candidatesPerSecond, int positionsPerFrame) {
     Rectangle panel = { SCREEN_WIDTH - UI_PANEL_WIDTH, 0, UI_PANEL_WIDTH, SCREEN_HEIGHT };
     DrawRectangleRec(panel, GetColor(0x222222DD));
     DrawLine(panel.x, 0, panel.x, SCREEN_HEIGHT, GetColor(0x555555FF));
@@ -531,7 +1675,9 @@ static void draw_ui_panel(State currentState, int packedCount, float* posStep, f
         } break;
         case STATE_PACKING: {
             DrawText("PACKING...", panel.x + 20, yPos, 22, RAYWHITE); yPos += 42;
-            DrawText(TextFormat("Shapes Placed: %d", packedCount), panel.x + 20, yPos, 16, LIGHTGRAY);
+            DrawText(TextFormat("Shapes Placed: %d", packedCount), panel.x + 20, yPos, 16, LIGHTGRAY); yPos += 22;
+            DrawText(TextFormat("Candidates/s: %.0f", candidatesPerSecond), panel.x + 20, yPos, 16, LIGHTGRAY); yPos += 22;
+            DrawText(TextFormat("Positions/Frame: %d", positionsPerFrame), panel.x + 20, yPos, 16, LIGHTGRAY);
         } break;
         case STATE_DONE: {
             DrawText("PACKING COMPLETE!", panel.x + 20, yPos, 20, RAYWHITE); yPos += 40;
@@ -547,6 +1693,11 @@ static void draw_ui_panel(State currentState, int packedCount, float* posStep, f
             DrawText("Press 'R' to restart", panel.x + 20, yPos, 18, SKYBLUE);
             yPos += 30;
             DrawText("Press 'A' to keep container", panel.x + 20, yPos, 18, SKYBLUE);
+            yPos += 30;
+            DrawText("Press 'C' to compact and refill", panel.x + 20, yPos, 18, SKYBLUE);
+            yPos += 30;
+            const char* cornerNames[] = { "Top Left", "Top Right", "Bottom Left", "Bottom Right" };
+            DrawText(TextFormat("TAB: Corner (%s)", cornerNames[compactCorner]), panel.x + 20, yPos, 18, LIGHTGRAY);
         } break;
     }
 
@@ -554,11 +1705,18 @@ static void draw_ui_panel(State currentState, int packedCount, float* posStep, f
     *posStep = gui_slider((Rectangle){panel.x + 20, yPos, panel.width - 40, 20}, "Position Step", *posStep, 0.2f, 5.f);
     yPos += 70;
     *rotationStep = gui_slider((Rectangle){panel.x + 20, yPos, panel.width - 40, 20}, "Rotation Step", *rotationStep, 0.1f, 15.f);
+    yPos += 70;
+    *proxyTolerance = gui_slider((Rectangle){panel.x + 20, yPos, panel.width - 40, 20}, "Proxy Tolerance", *proxyTolerance, 0.f, 10.f);
+    yPos += 40;
+    DrawText(TextFormat("M: Angle Mode (%s)", ANGLE_MODE_SAMPLED == angleMode ? "Sampled" : "Analytic"), panel.x + 20, yPos, 18, LIGHTGRAY);
 
-    yPos += 200;
+    yPos += 90;
     static float masterVol = 0.5f;
     masterVol = gui_slider((Rectangle){panel.x + 20, yPos, panel.width - 40, 20}, "Master Volume", masterVol, 0.f, 1.f);
     SetMasterVolume(masterVol);
+
+    yPos += 50;
+    DrawText("RMB Drag: Pan   Wheel: Zoom", panel.x + 20, yPos, 16, LIGHTGRAY);
 }
 
 static float gui_slider(Rectangle bounds, const char *text, float value, float minValue, float maxValue) {
@@ -636,6 +1794,287 @@ static char check_poly_collisions(const Polygon* p1, const Polygon* p2) {
     return 1;
 }
 
+static void place_candidate(const Packer* p, float angle, Vector2 pos, PackedShape* candidate) {
+    // one sin/cos for all three outlines instead of one per vertex
+    const float c = cosf(angle);
+    const float s = sinf(angle);
+    const Polygon* sources[3] = { &p->inner, &p->innerProxy, &p->innerCore };
+    Polygon* targets[3] = { &candidate->poly, &candidate->proxy, &candidate->core };
+    for (int k = 0; k < 3; k += 1) {
+        targets[k]->vertexCount = sources[k]->vertexCount;
+        for (int i = 0; i < sources[k]->vertexCount; i += 1) {
+            const Vector2 v = sources[k]->vertices[i];
+            targets[k]->vertices[i] = (Vector2){ v.x * c - v.y * s + pos.x, v.x * s + v.y * c + pos.y };
+        }
+    }
+    candidate->bounds = get_poly_bounds(&candidate->poly);
+}
+
+static char is_candidate_valid(Packer* p, const PackedShape* candidate) {
+    p->candidateCount += 1;
+    return is_candidate_inside(p, candidate) && !does_shape_overlap_packed(p, candidate);
+}
+
+static char is_candidate_inside(const Packer* p, const PackedShape* candidate) {
+    // core vertices are the shape's outermost vertices, so one of them outside rejects it early
+    for (int i = 0; i < candidate->core.vertexCount; i += 1) {
+        if (!CheckCollisionPointPoly(candidate->core.vertices[i], p->container.vertices, p->container.vertexCount)) {
+            return 0;
+        }
+    }
+
+    // the proxy encloses the shape, so if it fits the exact test can be skipped. when it doesn't the
+    // work is wasted, so it is only tried when it is a lot cheaper than the exact test
+    if (candidate->proxy.vertexCount > 0 && candidate->proxy.vertexCount * 2 <= candidate->poly.vertexCount &&
+        is_shape_inside_container(&candidate->proxy, &p->container)
+    ) {
+        return 1;
+    }
+    return is_shape_inside_container(&candidate->poly, &p->container);
+}
+
+// whether the shape fits only changes at angles where one of its vertices crosses an obstacle edge or an
+// obstacle vertex crosses one of its edges. each crossing also says which way the vertex went, so tracking
+// how many vertices sit where they shouldn't through the sorted crossings rules out every interval where
+// that count isn't zero without testing it. the rest are probed just past their start and in the middle.
+// p->sweepInd is 0 before the crossings are found, 1 before angle 0 is tried, then 2 + 2 * interval + probe
+static SweepResult find_analytic_angle(Packer* p, Vector2 pos, float sweepLimit, long long candidateLimit, PackedShape* candidate) {
+    if (0 == p->sweepInd) {
+        const Polygon* inner = &p->inner;
+        const float radius = poly_radius(inner);
+        const Rectangle reach = { pos.x - radius, pos.y - radius, radius * 2.f, radius * 2.f };
+
+        p->nearbyCount = 0;
+        if (p->count > 0) {
+            const unsigned int stamp = grid_next_stamp(p);
+
+            int minX, minY, maxX, maxY;
+            grid_cell_range(p, reach, &minX, &minY, &maxX, &maxY);
+
+            for (int y = minY; y <= maxY; y += 1) {
+                for (int x = minX; x <= maxX; x += 1) {
+                    const GridCell* cell = &p->grid[y * p->gridCols + x];
+                    for (int i = 0; i < cell->count; i += 1) {
+                        const int shapeInd = cell->shapeInds[i];
+                        if (stamp == p->checkedStamps[shapeInd]) {
+                            continue;
+                        }
+
+                        p->checkedStamps[shapeInd] = stamp;
+                        if (!CheckCollisionRecs(reach, p->shapes[shapeInd].bounds)) {
+                            continue;
+                        }
+
+                        if (p->nearbyCount >= p->nearbyCap) {
+                            p->nearbyCap = (0 == p->nearbyCap) ? 16 : p->nearbyCap * 2;
+                            p->nearbyInds = realloc(p->nearbyInds, p->nearbyCap * sizeof(int));
+                            if (!p->nearbyInds) {
+                                p->nearbyCap = 0;
+                                p->nearbyCount = 0;
+                                return SWEEP_NONE;
+                            }
+                        }
+                        p->nearbyInds[p->nearbyCount] = shapeInd;
+                        p->nearbyCount += 1;
+                    }
+                }
+            }
+        }
+
+        ContactEvent* events = p->events;
+        int count = add_contact_events(inner, pos, radius, &p->container, 1, sweepLimit, events, 0);
+        for (int i = 0; i < p->nearbyCount; i += 1) {
+            count = add_contact_events(inner, pos, radius, &p->shapes[p->nearbyInds[i]].poly, 0, sweepLimit, events, count);
+        }
+        qsort(events, count, sizeof(ContactEvent), compare_contact_events);
+        p->eventCount = count;
+        p->violations = 0;
+        p->isViolationStale = 1;
+        p->sweepInd = 1;
+    }
+
+    // the unrotated shape is the one most likely to fit flush against its neighbours, and a crossing landing
+    // exactly on 0 would otherwise leave it only an empty interval
+    if (1 == p->sweepInd) {
+        if (p->candidateCount >= candidateLimit) {
+            return SWEEP_PAUSED;
+        }
+
+        p->sweepInd = 2;
+        place_candidate(p, 0.f, pos, candidate);
+        if (is_candidate_valid(p, candidate)) {
+            return SWEEP_FOUND;
+        }
+    }
+
+    // interval i runs from crossing i - 1 to crossing i, with 0 and sweepLimit at the ends. the count is
+    // carried through isolated crossings, but crossings that (nearly) coincide can come out in either order
+    // or be dropped at a polygon vertex, so past them it is taken again in the middle of the next interval.
+    // dropped crossings from a full event buffer mean nothing can be ruled out
+    const ContactEvent* events = p->events;
+    const int count = p->eventCount;
+    const char isCountValid = count < MAX_CONTACT_EVENTS;
+    while (p->sweepInd < 2 + (count + 1) * 2) {
+        if (p->candidateCount >= candidateLimit) {
+            return SWEEP_PAUSED;
+        }
+
+        const int i = (p->sweepInd - 2) / 2;
+        const int probe = (p->sweepInd - 2) % 2;
+        p->sweepInd += 1;
+
+        const float start = (0 == i) ? 0.f : events[i - 1].angle;
+        const float end = (i < count) ? events[i].angle : sweepLimit;
+        if (0 == probe) {
+            p->violations += (i > 0) ? events[i - 1].delta : 0;
+
+            if (end - start <= 0.f) {
+                p->isViolationStale = 1;
+                p->sweepInd += 1;
+                continue;
+            }
+
+            if (end - start < ANALYTIC_COINCIDE_ANGLE) {
+                p->isViolationStale = 1;
+            } else if (isCountValid && (p->isViolationStale || p->violations < 0)) {
+                place_candidate(p, (start + end) * 0.5f, pos, candidate);
+                p->violations = count_contact_violations(&candidate->poly, &p->container, 1);
+                for (int k = 0; k < p->nearbyCount; k += 1) {
+                    p->violations += count_contact_violations(&candidate->poly, &p->shapes[p->nearbyInds[k]].poly, 0);
+                }
+                p->isViolationStale = 0;
+            }
+
+            if (isCountValid && !p->isViolationStale && p->violations > 0) {
+                p->sweepInd += 1;
+                continue;
+            }
+        }
+
+        // smallest angle in the interval that isn't touching, then the middle in case that was too close to call
+        const float angle = (0 == probe) ? start + MIN(ANALYTIC_ANGLE_MARGIN, (end - start) * 0.5f) : (start + end) * 0.5f;
+        place_candidate(p, angle, pos, candidate);
+        if (is_candidate_valid(p, candidate)) {
+            return SWEEP_FOUND;
+        }
+    }
+
+    return SWEEP_NONE;
+}
+
+// appends the crossings in [0, sweepLimit) between inner, rotated about pos, and obstacle. angles aren't
+// folded, since with only approximate symmetry a crossing past sweepLimit isn't exactly one before it
+static int add_contact_events(const Polygon* inner, Vector2 pos, float radius, const Polygon* obstacle, char isContainer, float sweepLimit, ContactEvent* events, int count) {
+    const Rectangle reach = { pos.x - radius, pos.y - radius, radius * 2.f, radius * 2.f };
+    const char isObstacleCCW = poly_area(obstacle) > 0.f;
+    const char isInnerCCW = poly_area(inner) > 0.f;
+    Vector2 hits[2];
+
+    for (int j = 0; j < obstacle->vertexCount; j += 1) {
+        const Vector2 a = obstacle->vertices[j];
+        const Vector2 b = obstacle->vertices[(j + 1) % obstacle->vertexCount];
+        const Rectangle edgeBox = { MIN(a.x, b.x), MIN(a.y, b.y), fabsf(b.x - a.x), fabsf(b.y - a.y) };
+        if (!CheckCollisionRecs(reach, edgeBox) && !CheckCollisionPointRec(a, reach)) {
+            continue;
+        }
+
+        // shape vertex moving along its circle crosses the obstacle edge
+        const Vector2 edge = Vector2Subtract(b, a);
+        for (int i = 0; i < inner->vertexCount; i += 1) {
+            const float r = Vector2Length(inner->vertices[i]);
+            const float base = atan2f(inner->vertices[i].y, inner->vertices[i].x);
+            const int hitCount = circle_segment_hits(pos, r, a, b, hits);
+            for (int h = 0; h < hitCount && count < MAX_CONTACT_EVENTS; h += 1) {
+                const Vector2 q = Vector2Subtract(hits[h], pos);
+                const float angle = fmodf(fmodf(atan2f(q.y, q.x) - base, 2.f * PI) + 2.f * PI, 2.f * PI);
+                if (angle >= sweepLimit) {
+                    continue;
+                }
+
+                // the vertex moves along (-q.y, q.x), interiors are to the left of edges of a CCW polygon
+                const char isEntering = (edge.x * q.x + edge.y * q.y > 0.f) == isObstacleCCW;
+                events[count] = (ContactEvent){ .angle = angle, .delta = (isEntering != isContainer) ? 1 : -1 };
+                count += 1;
+            }
+        }
+
+        // obstacle vertex crosses a shape edge, solved in the shape's frame where the vertex moves instead
+        const Vector2 local = Vector2Subtract(a, pos);
+        const float d = Vector2Length(local);
+        if (d > radius) {
+            continue;
+        }
+
+        const float base = atan2f(local.y, local.x);
+        for (int i = 0; i < inner->vertexCount; i += 1) {
+            const Vector2 u = inner->vertices[i];
+            const Vector2 v = inner->vertices[(i + 1) % inner->vertexCount];
+            const int hitCount = circle_segment_hits(Vector2Zero(), d, u, v, hits);
+            for (int h = 0; h < hitCount && count < MAX_CONTACT_EVENTS; h += 1) {
+                const float angle = fmodf(fmodf(base - atan2f(hits[h].y, hits[h].x), 2.f * PI) + 2.f * PI, 2.f * PI);
+                if (angle >= sweepLimit) {
+                    continue;
+                }
+
+                // here the vertex moves along (hit.y, -hit.x)
+                const Vector2 shapeEdge = Vector2Subtract(v, u);
+                const char isEntering = (-shapeEdge.x * hits[h].x - shapeEdge.y * hits[h].y > 0.f) == isInnerCCW;
+                events[count] = (ContactEvent){ .angle = angle, .delta = isEntering ? 1 : -1 };
+                count += 1;
+            }
+        }
+    }
+
+    return count;
+}
+
+// vertices sitting where they shouldn't. for the container, shape vertices outside it and container
+// vertices inside the shape, for a packed shape, vertices of either one inside the other.
+// any of those means the shape doesn't fit
+static int count_contact_violations(const Polygon* shape, const Polygon* obstacle, char isContainer) {
+    int violations = 0;
+    for (int i = 0; i < shape->vertexCount; i += 1) {
+        if (CheckCollisionPointPoly(shape->vertices[i], obstacle->vertices, obstacle->vertexCount) != (bool)isContainer) {
+            violations += 1;
+        }
+    }
+    for (int i = 0; i < obstacle->vertexCount; i += 1) {
+        if (CheckCollisionPointPoly(obstacle->vertices[i], shape->vertices, shape->vertexCount)) {
+            violations += 1;
+        }
+    }
+    return violations;
+}
+
+static int circle_segment_hits(Vector2 center, float r, Vector2 a, Vector2 b, Vector2 hits[2]) {
+    const Vector2 d = Vector2Subtract(b, a);
+    const Vector2 f = Vector2Subtract(a, center);
+    const float qa = Vector2DotProduct(d, d);
+    const float qb = 2.f * Vector2DotProduct(f, d);
+    const float qc = Vector2DotProduct(f, f) - r * r;
+    const float disc = qb * qb - 4.f * qa * qc;
+    if (qa <= 0.f || disc < 0.f) {
+        return 0;
+    }
+
+    const float sq = sqrtf(disc);
+    const float ts[2] = { (-qb - sq) / (2.f * qa), (-qb + sq) / (2.f * qa) };
+    int count = 0;
+    for (int i = 0; i < 2; i += 1) {
+        if (ts[i] >= 0.f && ts[i] < 1.f) { // half open, so a crossing through a polygon vertex counts once
+            hits[count] = Vector2Add(a, Vector2Scale(d, ts[i]));
+            count += 1;
+        }
+    }
+    return count;
+}
+
+static int compare_contact_events(const void* a, const void* b) {
+    const float fa = ((const ContactEvent*)a)->angle;
+    const float fb = ((const ContactEvent*)b)->angle;
+    return (fa > fb) - (fa < fb);
+}
+
 static void project_poly(Vector2 axis, const Vector2* vertices, int vertexCount, float* min, float* max) {
     *min = Vector2DotProduct(vertices[0], axis);
     *max = *min;
@@ -676,6 +2115,15 @@ static void draw_poly_lines(const Vector2* vertices, int vertexCount, Color colo
     }
 }
 
+// distance from the origin to the farthest vertex, i.e. the reach of a centered poly at any rotation
+static float poly_radius(const Polygon* poly) {
+    float radius = 0.f;
+    for (int i = 0; i < poly->vertexCount; i += 1) {
+        radius = MAX(radius, Vector2Length(poly->vertices[i]));
+    }
+    return radius;
+}
+
 static float poly_area(const Polygon* poly) {
     float area = 0;
     for (int i = 0; i < poly->vertexCount; i += 1) {
@@ -698,3 +2146,203 @@ static void ensure_winding(Polygon* poly) {
     }
 }
 
+// largest n such that rotating the (already centered) poly by 360/n degrees about the origin
+// lands every vertex on another vertex, i.e. the packing sweep only needs to cover 360/n degrees
+static int poly_rotational_symmetry(const Polygon* poly, float tolerance) {
+    const int n = poly->vertexCount;
+    for (int order = n; order >= 2; order -= 1) {
+        if (0 != n % order) {
+            continue;
+        }
+
+        const float angle = 2.f * PI / order;
+        const int shift = n / order;
+        for (int dir = -1; dir <= 1; dir += 2) { // which neighbour a vertex lands on depends on winding
+            char matches = 1;
+            for (int i = 0; i < n && matches; i += 1) {
+                const Vector2 rotated = Vector2Rotate(poly->vertices[i], angle);
+                const Vector2 target = poly->vertices[(i + dir * shift + n) % n];
+                matches = Vector2Distance(rotated, target) <= tolerance;
+            }
+            if (matches) {
+                return order;
+            }
+        }
+    }
+    return 1;
+}
+
+// monotone chain, returns the hull's vertex count
+static int poly_convex_hull(const Polygon* poly, Vector2 hull[MAX_VERTICES * 2]) {
+    if (poly->vertexCount < 3) {
+        return 0;
+    }
+
+    Vector2 sorted[MAX_VERTICES];
+    memcpy(sorted, poly->vertices, poly->vertexCount * sizeof(Vector2));
+    for (int i = 1; i < poly->vertexCount; i += 1) {
+        const Vector2 v = sorted[i];
+        int j = i - 1;
+        for (; j >= 0 && (sorted[j].x > v.x || (sorted[j].x == v.x && sorted[j].y > v.y)); j -= 1) {
+            sorted[j + 1] = sorted[j];
+        }
+        sorted[j + 1] = v;
+    }
+
+    // lower then upper hull
+    int count = 0;
+    for (int pass = 0; pass < 2; pass += 1) {
+        const int start = count;
+        for (int k = 0; k < poly->vertexCount; k += 1) {
+            const Vector2 v = sorted[0 == pass ? k : poly->vertexCount - 1 - k];
+            while (count >= start + 2) {
+                const Vector2 a = Vector2Subtract(hull[count - 1], hull[count - 2]);
+                const Vector2 b = Vector2Subtract(v, hull[count - 2]);
+                if (a.x * b.y - a.y * b.x > 0.f) {
+                    break;
+                }
+                count -= 1;
+            }
+            hull[count] = v;
+            count += 1;
+        }
+        count -= 1; // last point is the first point of the other chain
+    }
+    return count;
+}
+
+// convex hull of poly, then repeatedly drop the edge whose removal (extending both neighbouring
+// edges until they meet) bulges out the least, as long as the bulge stays within tolerance.
+// the result always encloses poly, so it can stand in for it whenever a test can only get more permissive
+static void build_collision_proxy(const Polygon* poly, Polygon* proxy, float tolerance) {
+    proxy->vertexCount = 0;
+    proxy->isClosed = 1;
+
+    Vector2 hull[MAX_VERTICES * 2];
+    int count = poly_convex_hull(poly, hull);
+    if (count < 3) {
+        return;
+    }
+
+    while (count > 3) {
+        int bestEdge = -1;
+        float bestBulge = tolerance;
+        Vector2 bestPoint = {0};
+        for (int i = 0; i < count; i += 1) {
+            const Vector2 a = hull[i];
+            const Vector2 b = hull[(i + 1) % count];
+            const Vector2 prevDir = Vector2Subtract(a, hull[(i + count - 1) % count]);
+            const Vector2 nextDir = Vector2Subtract(hull[(i + 2) % count], b);
+            const float denom = prevDir.x * nextDir.y - prevDir.y * nextDir.x;
+            if (denom <= 0.f) {
+                continue; // neighbouring edges diverge, they never meet past this edge
+            }
+
+            const Vector2 ab = Vector2Subtract(b, a);
+            const float t = (ab.x * nextDir.y - ab.y * nextDir.x) / denom;
+            const Vector2 p = Vector2Add(a, Vector2Scale(prevDir, t));
+            const float bulge = fabsf(ab.x * (p.y - a.y) - ab.y * (p.x - a.x)) / Vector2Length(ab);
+            if (t >= 0.f && bulge <= bestBulge) {
+                bestEdge = i;
+                bestBulge = bulge;
+                bestPoint = p;
+            }
+        }
+        if (-1 == bestEdge) {
+            break;
+        }
+
+        // replace both endpoints of the dropped edge with the intersection point
+        hull[bestEdge] = bestPoint;
+        const int removed = (bestEdge + 1) % count;
+        for (int i = removed; i < count - 1; i += 1) {
+            hull[i] = hull[i + 1];
+        }
+        count -= 1;
+    }
+
+    if (count >= poly->vertexCount) {
+        return;
+    }
+
+    memcpy(proxy->vertices, hull, count * sizeof(Vector2));
+    proxy->vertexCount = count;
+}
+
+// convex hull of poly, then repeatedly drop the hull vertex that cuts away the least area until at
+// most maxVertices are left. the result lies inside the hull, so it overlapping something proves the hull does
+static void build_collision_core(const Polygon* poly, Polygon* core, int maxVertices) {
+    core->vertexCount = 0;
+    core->isClosed = 1;
+
+    Vector2 hull[MAX_VERTICES * 2];
+    int count = poly_convex_hull(poly, hull);
+    while (count > maxVertices && count > 3) {
+        int bestVert = 0;
+        float bestArea = -1.f;
+        for (int i = 0; i < count; i += 1) {
+            const Vector2 a = Vector2Subtract(hull[i], hull[(i + count - 1) % count]);
+            const Vector2 b = Vector2Subtract(hull[(i + 1) % count], hull[(i + count - 1) % count]);
+            const float area = fabsf(a.x * b.y - a.y * b.x);
+            if (bestArea < 0.f || area < bestArea) {
+                bestVert = i;
+                bestArea = area;
+            }
+        }
+
+        for (int i = bestVert; i < count - 1; i += 1) {
+            hull[i] = hull[i + 1];
+        }
+        count -= 1;
+    }
+
+    if (count < 3 || count >= poly->vertexCount) {
+        return;
+    }
+
+    memcpy(core->vertices, hull, count * sizeof(Vector2));
+    core->vertexCount = count;
+}
+
+static char is_poly_convex(const Polygon* poly) {
+    char sign = 0;
+    for (int i = 0; i < poly->vertexCount; i += 1) {
+        const Vector2 a = Vector2Subtract(poly->vertices[(i + 1) % poly->vertexCount], poly->vertices[i]);
+        const Vector2 b = Vector2Subtract(poly->vertices[(i + 2) % poly->vertexCount], poly->vertices[(i + 1) % poly->vertexCount]);
+        const float cross = a.x * b.y - a.y * b.x;
+        if (0.f == cross) {
+            continue;
+        }
+
+        const char s = cross > 0.f ? 1 : -1;
+        if (0 != sign && s != sign) {
+            return 0;
+        }
+        sign = s;
+    }
+    return 1;
+}
+
+// horizontal extent of a convex poly along the line at y, 0 if the line misses it
+static char poly_scanline_span(const Polygon* poly, float y, float* minX, float* maxX) {
+    char found = 0;
+    for (int i = 0; i < poly->vertexCount; i += 1) {
+        const Vector2 a = poly->vertices[i];
+        const Vector2 b = poly->vertices[(i + 1) % poly->vertexCount];
+        if (y < MIN(a.y, b.y) || y > MAX(a.y, b.y)) {
+            continue;
+        }
+
+        const float x = (a.y == b.y) ? a.x : a.x + (y - a.y) / (b.y - a.y) * (b.x - a.x);
+        const float x2 = (a.y == b.y) ? b.x : x;
+        if (!found) {
+            *minX = MIN(x, x2);
+            *maxX = MAX(x, x2);
+            found = 1;
+        } else {
+            *minX = MIN(*minX, MIN(x, x2));
+            *maxX = MAX(*maxX, MAX(x, x2));
+        }
+    }
+    return found;
+}